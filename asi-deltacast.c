@@ -158,8 +158,7 @@ void asi_deltacast_Open( void )
 static void asi_deltacast_Read(struct ev_loop *loop, struct ev_io *w, int revents)
 {
     BOOL res;
-    block_t *p_ts, **pp_current = &p_ts;
-    int i;
+    block_t *p_ts = NULL, **pp_current = &p_ts;
     ULONG Err;
 
     res = Asi_GetInputBuffer(h_channel, &p_asibuf, &i_asibuf_len,
@@ -194,13 +193,8 @@ static void asi_deltacast_Read(struct ev_loop *loop, struct ev_io *w, int revent
 
     ev_timer_again(loop, &mute_watcher);
 
-    for (i = 0; i < i_asibuf_len / TS_SIZE; i++)
-    {
-        *pp_current = block_New();
-        memcpy((*pp_current)->p_ts, p_asibuf + (i * TS_SIZE), TS_SIZE);
-        pp_current = &(*pp_current)->p_next;
-
-    }
+    pp_current = tssync_RunBuffer( p_asibuf, i_asibuf_len, true, pp_current );
+    *pp_current = NULL;
 
     res = Asi_ReleaseInputBuffer(h_channel);
 
@@ -210,7 +210,7 @@ static void asi_Read(struct ev_loop *loop, struct ev_io *w, int revents)
     }
 
     struct iovec p_iov[i_bufsize / TS_SIZE];
-    block_t *p_ts, **pp_current = &p_ts;
+    block_t *p_ts, *p_block, **pp_current = &p_ts;
     int i, i_len;
 
     for ( i = 0; i < i_bufsize / TS_SIZE; i++ )
@@ -227,7 +227,6 @@ static void asi_Read(struct ev_loop *loop, struct ev_io *w, int revents)
                  i_asi_adapter, strerror(errno) );
         i_len = 0;
     }
-    i_len /= TS_SIZE;
 
     if ( i_len )
     {
@@ -251,18 +250,21 @@ static void asi_Read(struct ev_loop *loop, struct ev_io *w, int revents)
         ev_timer_again(loop, &mute_watcher);
     }
 
+    /* Keep the partial packet, the stream may not be aligned */
     pp_current = &p_ts;
-    while ( i_len && *pp_current )
-    {
+    for ( i = 0; i < (i_len + TS_SIZE - 1) / TS_SIZE; i++ )
         pp_current = &(*pp_current)->p_next;
-        i_len--;
-    }
 
-    if ( *pp_current )
+    if ( i_len < i_bufsize )
         msg_Dbg( NULL, "partial buffer received" );
     block_DeleteChain( *pp_current );
     *pp_current = NULL;
 
+    p_block = p_ts;
+    p_ts = NULL;
+    pp_current = tssync_Run( p_block, i_len, true, &p_ts );
+    *pp_current = NULL;
+
     demux_Run( p_ts );
 }
 
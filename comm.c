@@ -148,6 +148,17 @@ static void comm_Read(struct ev_loop *loop, struct ev_io *w, int revents)
                                        &i_answer_size );
         break;
 
+    case CMD_GET_DVR_STATUS:
+        if ( pf_Open == dvb_Open )
+            i_answer = dvb_DVRStatus( p_answer + COMM_HEADER_SIZE,
+                                      &i_answer_size );
+        else
+        {
+            i_answer = RET_NODATA;
+            i_answer_size = 0;
+        }
+        break;
+
     case CMD_MMI_STATUS:
         i_answer = en50221_StatusMMI( p_answer + COMM_HEADER_SIZE,
                                       &i_answer_size );
@@ -258,6 +269,34 @@ static void comm_Read(struct ev_loop *loop, struct ev_io *w, int revents)
         break;
     }
 
+    case CMD_GET_INPUT_STATUS:
+        if ( pf_InputStatus != NULL )
+            i_answer = pf_InputStatus( p_output, &i_answer_size );
+        else
+        {
+            i_answer = RET_NODATA;
+            i_answer_size = 0;
+        }
+        break;
+
+    case CMD_GET_OUTPUT_STATUS:
+        i_answer = outputs_Status( p_output, &i_answer_size );
+        break;
+
+    case CMD_GET_RTCP_STATUS:
+        i_answer = outputs_RTCPStatus( p_output, &i_answer_size );
+        break;
+
+    case CMD_GET_POOL_STATUS:
+    {
+        struct ret_pool_status *p_ret = (struct ret_pool_status *)p_output;
+        block_Status( &p_ret->blocks );
+        outputs_PoolStatus( &p_ret->packets );
+        i_answer = RET_POOL_STATUS;
+        i_answer_size = sizeof(struct ret_pool_status);
+        break;
+    }
+
     case CMD_GET_PIDS:
     {
         i_answer = RET_PIDS;
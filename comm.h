@@ -49,6 +49,11 @@ typedef enum {
     CMD_MMI_SEND_CHOICE     = 18, /* arg: slot, en50221_mmi_object_t */
     CMD_GET_EIT_PF          = 19, /* arg: service_id (uint16_t) */
     CMD_GET_EIT_SCHEDULE    = 20, /* arg: service_id (uint16_t) */
+    CMD_GET_INPUT_STATUS    = 21,
+    CMD_GET_DVR_STATUS      = 22,
+    CMD_GET_OUTPUT_STATUS   = 23,
+    CMD_GET_RTCP_STATUS     = 24,
+    CMD_GET_POOL_STATUS     = 25,
 } ctl_cmd_t;
 
 typedef enum {
@@ -69,6 +74,11 @@ typedef enum {
     RET_PID                 = 14,
     RET_EIT_PF              = 15,
     RET_EIT_SCHEDULE        = 16,
+    RET_INPUT_STATUS        = 17,
+    RET_DVR_STATUS          = 18,
+    RET_OUTPUT_STATUS       = 19,
+    RET_RTCP_STATUS         = 20,
+    RET_POOL_STATUS         = 21,
     RET_HUH                 = 255,
 } ctl_cmd_answer_t;
 
@@ -79,6 +89,20 @@ struct ret_frontend_status
     fe_status_t i_status;
     uint32_t i_ber;
     uint16_t i_strength, i_snr;
+    uint32_t i_dvr_buffer_size;
+    uint64_t i_dvr_overflows;
+};
+
+/* Bucket i counts the reads of 2^i to 2^(i+1)-1 packets */
+#define DVR_HISTOGRAM_SIZE 14
+
+struct ret_dvr_status
+{
+    uint32_t i_batch;     /* current packets per read */
+    uint32_t i_max_batch; /* largest read */
+    uint64_t i_reads;
+    uint64_t i_packets;
+    uint64_t pi_histogram[DVR_HISTOGRAM_SIZE];
 };
 
 struct ret_mmi_status
@@ -107,3 +131,69 @@ struct cmd_pid_info
 {
     ts_pid_info_t pids[MAX_PIDS];
 };
+
+#define INPUT_MAX_PATHS 2
+
+struct ret_input_path
+{
+    uint64_t i_datagrams; /* received on this path */
+    uint64_t i_forwarded; /* first copies handed to the demux */
+    uint64_t i_lost;      /* sequence gaps on this path */
+    uint64_t i_dropped;   /* dropped by the kernel */
+};
+
+struct ret_input_status
+{
+    uint32_t i_nb_paths;
+    uint64_t i_lost;      /* still missing after merging the paths */
+    struct ret_input_path paths[INPUT_MAX_PATHS];
+};
+
+/* Bucket i counts the calls sending 2^i to 2^(i+1)-1 datagrams */
+#define OUTPUT_HISTOGRAM_SIZE 8
+
+struct ret_output_status
+{
+    uint32_t i_max_batch; /* largest number of datagrams in one call */
+    uint64_t i_syscalls;
+    uint64_t i_datagrams;
+    uint64_t pi_histogram[OUTPUT_HISTOGRAM_SIZE];
+};
+
+#define RTCP_STATUS_MAX_OUTPUTS 1024
+
+struct ret_rtcp_output
+{
+    char psz_name[64];        /* output, truncated */
+    uint64_t i_packets;       /* RTP datagrams sent */
+    uint64_t i_octets;        /* payload sent */
+    uint64_t i_retransmitted; /* datagrams resent after NACKs */
+    uint64_t i_reports;       /* receiver reports about the output */
+    int64_t i_report_age;     /* us since the last report, -1 if none */
+    uint8_t i_fraction_lost;  /* in the last report, in 1/256 */
+    int32_t i_cumulative_lost;
+    int64_t i_jitter;         /* us */
+    int64_t i_rtt;            /* us, -1 if unknown */
+};
+
+struct ret_rtcp_status
+{
+    uint32_t i_nb_outputs;
+    struct ret_rtcp_output p_outputs[];
+};
+
+struct ret_pool
+{
+    uint32_t i_slot_size;
+    uint32_t i_slots;       /* 0 if the pool is disabled */
+    uint32_t i_used;
+    uint32_t i_high_water;  /* largest number of slots in use */
+    uint64_t i_exhausted;   /* allocations that fell back to malloc() */
+    uint8_t b_hugepages;
+};
+
+struct ret_pool_status
+{
+    struct ret_pool blocks;
+    struct ret_pool packets;
+};
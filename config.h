@@ -29,6 +29,12 @@
 #define HAVE_DVB_SUPPORT
 #define HAVE_ASI_SUPPORT
 #define HAVE_CLOCK_NANOSLEEP
+#define HAVE_RECVMMSG
+#define HAVE_SENDMMSG
+#define HAVE_UDP_GSO
+#define HAVE_PACKET_MMAP
+#define HAVE_SO_TIMESTAMPING
+#define HAVE_SO_TXTIME
 #endif
 
 #define HAVE_ICONV
@@ -47,10 +53,14 @@
 #define MIN_POLL_TIMEOUT 100 /* 100 us */
 #define DEFAULT_OUTPUT_LATENCY 200000 /* 200 ms */
 #define DEFAULT_MAX_RETENTION 40000 /* 40 ms */
+#define TXTIME_ADVANCE 10000 /* 10 ms, /txtime outputs are sent ahead */
 #define MAX_EIT_RETENTION 500000 /* 500 ms */
 #define DEFAULT_FRONTEND_TIMEOUT 30000000 /* 30 s */
 #define EXIT_STATUS_FRONTEND_TIMEOUT 100
 #define DEFAULT_UDP_LOCK_TIMEOUT 5000000 /* 5 s */
+#define DEFAULT_UDP_BATCH 1 /* datagrams per wakeup */
+#define MAX_UDP_BATCH 1024
+#define DEFAULT_UDP_MERGE_WINDOW 50000 /* 50 ms */
 
 // Compatability defines
 #if defined(__APPLE__)
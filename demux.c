@@ -54,6 +54,10 @@
  * Local declarations
  *****************************************************************************/
 #define MIN_SECTION_FRAGMENT    PSI_HEADER_SIZE_SYNTAX1
+#define PCR_LOCK_TIMEOUT        1000000 /* 1 s */
+#define PCR_LOCK_MAX_JUMP       500000 /* 500 ms */
+#define PCR_LOCK_DRIFT_FACTOR   64
+#define PCR_WRAP                ((UINT64_C(1) << 33) * 300)
 
 typedef struct ts_pid_t
 {
@@ -101,7 +105,7 @@ typedef struct sid_t
     unsigned long i_packets_passed;
 } sid_t;
 
-mtime_t i_wallclock = 0;
+__thread mtime_t i_wallclock = 0;
 
 static ts_pid_t p_pids[MAX_PIDS];
 static sid_t **pp_sids = NULL;
@@ -116,6 +120,18 @@ static PSI_TABLE_DECLARE(pp_next_nit_sections);
 static PSI_TABLE_DECLARE(pp_current_sdt_sections);
 static PSI_TABLE_DECLARE(pp_next_sdt_sections);
 static mtime_t i_last_dts = -1;
+
+/* PCR-locked dating (--dts-pcr-pid) */
+static bool b_pcr_lock = false;
+static uint16_t i_pcr_lock_pid = PADDING_PID;
+static uint64_t i_pcr_lock_last;     /* last PCR, 27 MHz */
+static uint64_t i_pcr_lock_time;     /* unwrapped PCR, 27 MHz */
+static mtime_t i_pcr_lock_offset;    /* wallclock - PCR time */
+static mtime_t i_pcr_lock_dts;       /* date of the last PCR packet */
+static mtime_t i_pcr_lock_seen;      /* wallclock of the last PCR */
+static int i_pcr_lock_packets = 0;   /* packets since the last PCR */
+static mtime_t i_pcr_lock_interval;  /* duration of the last PCR interval */
+static int i_pcr_lock_interval_packets = 0;
 static int i_demux_fd;
 static uint64_t i_nb_packets = 0;
 static uint64_t i_nb_invalids = 0;
@@ -135,6 +151,9 @@ static iconv_t iconv_handle = (iconv_t)-1;
  *****************************************************************************/
 static void demux_Handle( block_t *p_ts );
 static void SetDTS( block_t *p_list );
+static void SetDTSPCR( block_t *p_list, bool b_dated );
+static bool PCRLockDate( block_t *p_ts, mtime_t i_arrival, mtime_t *pi_date );
+static void demux_HandleList( block_t *p_ts );
 static void SetPID( uint16_t i_pid );
 static void SetPID_EMM( uint16_t i_pid );
 static void UnsetPID( uint16_t i_pid );
@@ -530,8 +549,33 @@ void demux_Run( block_t *p_ts )
 {
     i_wallclock = mdate();
     mrtgAnalyse( p_ts );
-    SetDTS( p_ts );
+    if ( i_dts_pcr_pid != -1 )
+        SetDTSPCR( p_ts, false );
+    else
+        SetDTS( p_ts );
+
+    demux_HandleList( p_ts );
+}
+
+/*****************************************************************************
+ * demux_RunDated: same as demux_Run, for inputs which already set i_dts to
+ * the arrival date of each packet
+ *****************************************************************************/
+void demux_RunDated( block_t *p_ts )
+{
+    i_wallclock = mdate();
+    mrtgAnalyse( p_ts );
+    if ( i_dts_pcr_pid != -1 )
+        SetDTSPCR( p_ts, true );
+
+    demux_HandleList( p_ts );
+}
 
+/*****************************************************************************
+ * demux_HandleList
+ *****************************************************************************/
+static void demux_HandleList( block_t *p_ts )
+{
     while ( p_ts != NULL )
     {
         block_t *p_next = p_ts->p_next;
@@ -539,6 +583,8 @@ void demux_Run( block_t *p_ts )
         demux_Handle( p_ts );
         p_ts = p_next;
     }
+
+    outputs_Wake();
 }
 
 /*****************************************************************************
@@ -1033,6 +1079,153 @@ static void SetDTS( block_t *p_list )
     i_last_dts = i_wallclock;
 }
 
+/*****************************************************************************
+ * SetDTSPCR: dates packets from the PCR of a reference PID, so that outputs
+ * reproduce the original packet timing instead of the input bursts
+ *****************************************************************************/
+static void SetDTSPCR( block_t *p_list, bool b_dated )
+{
+    block_t *p_ts, *p_pending = p_list;
+    int i_pending = 0, i;
+
+    if ( b_pcr_lock && i_pcr_lock_seen + PCR_LOCK_TIMEOUT < i_wallclock )
+    {
+        msg_Warn( NULL, "no PCR on PID %"PRIu16", falling back to CBR dating",
+                  i_pcr_lock_pid );
+        b_pcr_lock = false;
+        if ( i_dts_pcr_pid == MAX_PIDS )
+            i_pcr_lock_pid = PADDING_PID;
+    }
+
+    for ( p_ts = p_list; p_ts != NULL; p_ts = p_ts->p_next )
+    {
+        mtime_t i_date;
+        bool b_was_locked = b_pcr_lock;
+
+        i_pcr_lock_packets++;
+        i_pending++;
+        if ( !PCRLockDate( p_ts, b_dated ? p_ts->i_dts : i_wallclock,
+                           &i_date ) )
+            continue;
+
+        /* Spread the packets between the previous PCR and this one */
+        for ( i = 1; p_pending != p_ts->p_next; i++ )
+        {
+            if ( b_was_locked )
+                p_pending->i_dts = i_pcr_lock_dts
+                    + (i_date - i_pcr_lock_dts)
+                        * (i_pcr_lock_packets - i_pending + i)
+                        / i_pcr_lock_packets;
+            else
+                p_pending->i_dts = i_date;
+            p_pending = p_pending->p_next;
+        }
+
+        if ( b_was_locked )
+        {
+            i_pcr_lock_interval = i_date - i_pcr_lock_dts;
+            i_pcr_lock_interval_packets = i_pcr_lock_packets;
+        }
+        i_pcr_lock_dts = i_date;
+        i_pcr_lock_packets = 0;
+        i_pending = 0;
+    }
+
+    if ( p_pending != NULL )
+    {
+        if ( b_pcr_lock && i_pcr_lock_interval_packets )
+        {
+            /* Extrapolate at the rate of the last PCR interval */
+            for ( i = 1; p_pending != NULL; i++ )
+            {
+                mtime_t i_arrival = b_dated ? p_pending->i_dts : i_wallclock;
+                p_pending->i_dts = i_pcr_lock_dts
+                    + i_pcr_lock_interval
+                        * (i_pcr_lock_packets - i_pending + i)
+                        / i_pcr_lock_interval_packets;
+                if ( p_pending->i_dts > i_arrival )
+                    p_pending->i_dts = i_arrival;
+                p_pending = p_pending->p_next;
+            }
+        }
+        else if ( !b_dated )
+        {
+            /* No PCR interval yet, interpolate since the last known date */
+            if ( b_pcr_lock )
+                i_last_dts = i_pcr_lock_dts;
+            SetDTS( p_pending );
+        }
+    }
+
+    i_last_dts = i_wallclock;
+}
+
+/*****************************************************************************
+ * PCRLockDate: returns the wallclock date of a packet carrying a PCR of the
+ * reference PID, tracking the drift between the PCR and the wallclock
+ *****************************************************************************/
+static bool PCRLockDate( block_t *p_ts, mtime_t i_arrival, mtime_t *pi_date )
+{
+    uint16_t i_pid = ts_get_pid( p_ts->p_ts );
+    uint64_t i_pcr;
+    mtime_t i_time, i_offset;
+
+    if ( !ts_validate( p_ts->p_ts ) || !ts_has_adaptation( p_ts->p_ts )
+          || !ts_get_adaptation( p_ts->p_ts ) || !tsaf_has_pcr( p_ts->p_ts ) )
+        return false;
+
+    if ( i_pcr_lock_pid == PADDING_PID )
+    {
+        /* Automatic mode, lock on the first PCR of a selected PID */
+        if ( i_dts_pcr_pid == MAX_PIDS ? !p_pids[i_pid].i_refcount
+                                       : i_pid != i_dts_pcr_pid )
+            return false;
+        i_pcr_lock_pid = i_pid;
+        msg_Dbg( NULL, "dating packets from the PCR of PID %"PRIu16, i_pid );
+    }
+    else if ( i_pid != i_pcr_lock_pid )
+        return false;
+
+    i_pcr = tsaf_get_pcr( p_ts->p_ts ) * 300 + tsaf_get_pcrext( p_ts->p_ts );
+
+    if ( b_pcr_lock )
+    {
+        uint64_t i_delta = (i_pcr + PCR_WRAP - i_pcr_lock_last) % PCR_WRAP;
+        i_pcr_lock_time += i_delta;
+        i_time = i_pcr_lock_time / 27;
+        i_offset = i_arrival - i_time;
+
+        if ( i_offset - i_pcr_lock_offset > PCR_LOCK_MAX_JUMP
+              || i_offset - i_pcr_lock_offset < -PCR_LOCK_MAX_JUMP )
+        {
+            msg_Warn( NULL, "PCR discontinuity on PID %"PRIu16, i_pid );
+            i_pcr_lock_offset = i_offset;
+        }
+        else if ( i_offset < i_pcr_lock_offset )
+            /* The packet can't arrive early, follow immediately */
+            i_pcr_lock_offset = i_offset;
+        else
+            /* Late packets are mostly jitter, only follow slowly */
+            i_pcr_lock_offset += (i_offset - i_pcr_lock_offset)
+                                  / PCR_LOCK_DRIFT_FACTOR;
+    }
+    else
+    {
+        i_pcr_lock_time = i_pcr;
+        i_time = i_pcr_lock_time / 27;
+        i_pcr_lock_offset = i_arrival - i_time;
+        i_pcr_lock_interval_packets = 0;
+        b_pcr_lock = true;
+    }
+
+    i_pcr_lock_last = i_pcr;
+    i_pcr_lock_seen = i_wallclock;
+    *pi_date = i_time + i_pcr_lock_offset;
+    if ( *pi_date > i_arrival )
+        *pi_date = i_arrival;
+    return true;
+}
+
 /*****************************************************************************
  * SetPID/UnsetPID
  *****************************************************************************/
@@ -1711,6 +1904,10 @@ static void NewPMT( output_t *p_output )
     psi_set_version( p, p_output->i_pmt_version );
     psi_set_current( p );
     pmt_set_desclength( p, 0 );
+
+    /* The sender thread of the output reads the PID map */
+    if ( p_output->p_worker != NULL )
+        outputs_Lock();
     init_pid_mapping( p_output );
 
 
@@ -1738,6 +1935,8 @@ static void NewPMT( output_t *p_output )
         CopyDescriptors( pmtn_get_descs( p_es ),
                          pmtn_get_descs( p_current_es ) );
     }
+    if ( p_output->p_worker != NULL )
+        outputs_Unlock();
 
     /* Do the pcr pid after everything else as it may have been remapped */
     i_pcrpid = pmt_get_pcrpid( p_current_pmt );
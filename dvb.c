@@ -67,22 +67,43 @@
  * Local declarations
  *****************************************************************************/
 #define DVR_READ_TIMEOUT 30000000 /* 30 s */
-#define MAX_READ_ONCE 50
+#define DVR_MIN_BATCH 50 /* packets per read */
+#define DVR_MAX_BATCH 8192
+#define DVR_IOV_MAX 1024 /* per readv() */
+#define DVR_SHRINK_READS 16
 #define DVR_BUFFER_SIZE 40*188*1024 /* bytes */
+#define DVR_BUFFER_MAX 4*DVR_BUFFER_SIZE
+#define DVR_OVERFLOW_PERIOD 10000000 /* 10 s */
+#define DVR_OVERFLOW_GROW 3 /* overflows per period */
 
 int i_dvr_buffer_size = DVR_BUFFER_SIZE;
+int i_dvr_buffer_max = DVR_BUFFER_MAX;
 
 static int i_frontend, i_dvr;
 static struct ev_io frontend_watcher, dvr_watcher;
 static struct ev_timer lock_watcher, mute_watcher, print_watcher;
 static fe_status_t i_last_status;
-static block_t *p_freelist = NULL;
+
+/* The batch grows while reads fill it, and shrinks after short reads */
+static block_t *pp_dvr_blocks[DVR_MAX_BATCH];
+static struct iovec p_dvr_iov[DVR_MAX_BATCH];
+static int i_dvr_filled = 0;
+static int i_dvr_batch = DVR_MIN_BATCH, i_dvr_max_batch = 0;
+static int i_dvr_short_reads = 0;
+static uint64_t i_dvr_reads = 0, i_dvr_packets = 0;
+static uint64_t pi_dvr_histogram[DVR_HISTOGRAM_SIZE];
+
+/* Repeated overflows grow the ring up to i_dvr_buffer_max */
+static uint64_t i_dvr_overflows = 0;
+static int i_dvr_recent_overflows = 0;
+static mtime_t i_dvr_overflow_date = 0;
 
 /*****************************************************************************
  * Local prototypes
  *****************************************************************************/
 static void DVRRead(struct ev_loop *loop, struct ev_io *w, int revents);
 static void DVRMuteCb(struct ev_loop *loop, struct ev_timer *w, int revents);
+static void DVROverflow( void );
 static void FrontendRead(struct ev_loop *loop, struct ev_io *w, int revents);
 static void FrontendLockCb(struct ev_loop *loop, struct ev_timer *w, int revents);
 static void FrontendSet( bool b_reset );
@@ -161,42 +182,118 @@ void dvb_Reset( void )
  *****************************************************************************/
 static void DVRRead(struct ev_loop *loop, struct ev_io *w, int revents)
 {
-    int i, i_len;
-    block_t *p_ts = p_freelist, **pp_current = &p_ts;
-    struct iovec p_iov[MAX_READ_ONCE];
+    int i, i_len = 0, i_bucket;
+    block_t *p_ts = NULL, **pp_current = &p_ts;
 
-    for ( i = 0; i < MAX_READ_ONCE; i++ )
+    for ( ; i_dvr_filled < i_dvr_batch; i_dvr_filled++ )
     {
-        if ( (*pp_current) == NULL ) *pp_current = block_New();
-        p_iov[i].iov_base = (*pp_current)->p_ts;
-        p_iov[i].iov_len = TS_SIZE;
-        pp_current = &(*pp_current)->p_next;
+        pp_dvr_blocks[i_dvr_filled] = block_New();
+        p_dvr_iov[i_dvr_filled].iov_base = pp_dvr_blocks[i_dvr_filled]->p_ts;
+        p_dvr_iov[i_dvr_filled].iov_len = TS_SIZE;
     }
 
-    if ( (i_len = readv(i_dvr, p_iov, MAX_READ_ONCE)) < 0 )
+    while ( i_len < i_dvr_batch )
     {
-        msg_Err( NULL, "couldn't read from DVR device (%s)",
-                 strerror(errno) );
-        i_len = 0;
+        int i_iov = i_dvr_batch - i_len;
+        ssize_t i_read;
+
+        if ( i_iov > DVR_IOV_MAX )
+            i_iov = DVR_IOV_MAX;
+        if ( (i_read = readv(i_dvr, &p_dvr_iov[i_len], i_iov)) < 0 )
+        {
+            if ( errno == EOVERFLOW )
+                DVROverflow();
+            else if ( errno != EAGAIN || !i_len )
+                msg_Err( NULL, "couldn't read from DVR device (%s)",
+                         strerror(errno) );
+            break;
+        }
+        i_len += i_read / TS_SIZE;
+        if ( i_read < i_iov * TS_SIZE )
+            break;
+    }
+
+    i_dvr_reads++;
+    i_dvr_packets += i_len;
+    for ( i_bucket = 0; i_bucket < DVR_HISTOGRAM_SIZE - 1
+                         && (2 << i_bucket) <= i_len; i_bucket++ );
+    pi_dvr_histogram[i_bucket]++;
+    if ( i_len > i_dvr_max_batch )
+        i_dvr_max_batch = i_len;
+
+    if ( i_len == i_dvr_batch )
+    {
+        /* More is probably waiting, read more at once */
+        i_dvr_short_reads = 0;
+        if ( i_dvr_batch < DVR_MAX_BATCH )
+            i_dvr_batch = i_dvr_batch * 2 < DVR_MAX_BATCH ?
+                          i_dvr_batch * 2 : DVR_MAX_BATCH;
+    }
+    else if ( i_len < i_dvr_batch / 4 && i_dvr_batch > DVR_MIN_BATCH )
+    {
+        if ( ++i_dvr_short_reads >= DVR_SHRINK_READS )
+        {
+            i_dvr_short_reads = 0;
+            i_dvr_batch = i_dvr_batch / 2 > DVR_MIN_BATCH ?
+                          i_dvr_batch / 2 : DVR_MIN_BATCH;
+        }
     }
-    i_len /= TS_SIZE;
+    else
+        i_dvr_short_reads = 0;
 
     if ( i_len )
         ev_timer_again(loop, &mute_watcher);
 
-    pp_current = &p_ts;
-    while ( i_len && *pp_current )
+    /* Hand the filled blocks over and replace them */
+    for ( i = 0; i < i_len; i++ )
     {
+        *pp_current = pp_dvr_blocks[i];
         pp_current = &(*pp_current)->p_next;
-        i_len--;
+        pp_dvr_blocks[i] = block_New();
+        p_dvr_iov[i].iov_base = pp_dvr_blocks[i]->p_ts;
     }
-
-    p_freelist = *pp_current;
     *pp_current = NULL;
 
     demux_Run( p_ts );
 }
 
+/*****************************************************************************
+ * DVROverflow: the demux ring overflowed and the kernel dropped packets
+ *****************************************************************************/
+static void DVROverflow( void )
+{
+    mtime_t i_now = mdate();
+    int i_size;
+
+    i_dvr_overflows++;
+    msg_Warn( NULL, "DVR buffer overflow" );
+
+    if ( i_now > i_dvr_overflow_date + DVR_OVERFLOW_PERIOD )
+    {
+        i_dvr_overflow_date = i_now;
+        i_dvr_recent_overflows = 0;
+    }
+    if ( ++i_dvr_recent_overflows < DVR_OVERFLOW_GROW
+          || i_dvr_buffer_size >= i_dvr_buffer_max )
+        return;
+    i_dvr_recent_overflows = 0;
+
+    i_size = i_dvr_buffer_size > i_dvr_buffer_max / 2 ?
+             i_dvr_buffer_max : i_dvr_buffer_size * 2;
+    i_size -= i_size % TS_SIZE;
+
+    if ( ioctl( i_dvr, DMX_SET_BUFFER_SIZE, i_size ) < 0 )
+    {
+        msg_Warn( NULL, "couldn't grow DVR buffer to %d bytes (%s)", i_size,
+                  strerror(errno) );
+        i_dvr_buffer_max = i_dvr_buffer_size;
+        return;
+    }
+
+    msg_Info( NULL, "DVR buffer grown to %d bytes", i_size );
+    i_dvr_buffer_size = i_size;
+}
+
 static void DVRMuteCb(struct ev_loop *loop, struct ev_timer *w, int revents)
 {
     msg_Warn( NULL, "no DVR output, resetting" );
@@ -294,12 +391,12 @@ static void PrintCb( struct ev_loop *loop, struct ev_timer *w, int revents )
     {
         case PRINT_XML:
             fprintf(print_fh,
-                    "<STATUS type=\"frontend\" ber=\"%"PRIu32"\" strength=\"%"PRIu16"\" snr=\"%"PRIu16"\" uncorrected=\"%"PRIu32"\" />\n",
-                    i_ber, i_strength, i_snr, i_uncorrected);
+                    "<STATUS type=\"frontend\" ber=\"%"PRIu32"\" strength=\"%"PRIu16"\" snr=\"%"PRIu16"\" uncorrected=\"%"PRIu32"\" dvr_overflows=\"%"PRIu64"\" />\n",
+                    i_ber, i_strength, i_snr, i_uncorrected, i_dvr_overflows);
             break;
         case PRINT_TEXT:
-            fprintf(print_fh, "frontend ber: %"PRIu32" strength: %"PRIu16" snr: %"PRIu16" uncorrected: %"PRIu32"\n",
-                    i_ber, i_strength, i_snr, i_uncorrected);
+            fprintf(print_fh, "frontend ber: %"PRIu32" strength: %"PRIu16" snr: %"PRIu16" uncorrected: %"PRIu32" dvr overflows: %"PRIu64"\n",
+                    i_ber, i_strength, i_snr, i_uncorrected, i_dvr_overflows);
             break;
         default:
             break;
@@ -1520,8 +1617,29 @@ uint8_t dvb_FrontendStatus( uint8_t *p_answer, ssize_t *pi_size )
             msg_Err( NULL, "ioctl FE_READ_SNR failed (%s)", strerror(errno) );
     }
 
+    p_ret->i_dvr_overflows = i_dvr_overflows;
+    p_ret->i_dvr_buffer_size = i_dvr_buffer_size;
+
     *pi_size = sizeof(struct ret_frontend_status);
     return RET_FRONTEND_STATUS;
 }
 
+/*****************************************************************************
+ * dvb_DVRStatus
+ *****************************************************************************/
+uint8_t dvb_DVRStatus( uint8_t *p_answer, ssize_t *pi_size )
+{
+    struct ret_dvr_status *p_ret = (struct ret_dvr_status *)p_answer;
+
+    memset( p_ret, 0, sizeof(struct ret_dvr_status) );
+    p_ret->i_batch = i_dvr_batch;
+    p_ret->i_max_batch = i_dvr_max_batch;
+    p_ret->i_reads = i_dvr_reads;
+    p_ret->i_packets = i_dvr_packets;
+    memcpy( p_ret->pi_histogram, pi_dvr_histogram, sizeof(pi_dvr_histogram) );
+
+    *pi_size = sizeof(struct ret_dvr_status);
+    return RET_DVR_STATUS;
+}
+
 #endif
@@ -96,6 +96,17 @@ int b_any_type = 0;
 int b_select_pmts = 0;
 int b_random_tsid = 0;
 char *psz_udp_src = NULL;
+char *psz_udp_src2 = NULL;
+char *psz_packet_src = NULL;
+char *psz_file_src = NULL;
+bool b_file_fast = false;
+bool b_file_loop = false;
+bool b_io_uring = false;
+int i_output_threads = 0;
+size_t i_pool_size = 4 * 1024 * 1024;
+bool b_pool_hugepages = false;
+static const char *psz_http_listen = NULL;
+int i_dts_pcr_pid = -1;
 int i_asi_adapter = 0;
 const char *psz_native_charset = "UTF-8//IGNORE";
 print_type_t i_print_type = PRINT_TEXT;
@@ -137,6 +148,7 @@ void (*pf_Open)( void ) = NULL;
 void (*pf_Reset)( void ) = NULL;
 int (*pf_SetFilter)( uint16_t i_pid ) = NULL;
 void (*pf_UnsetFilter)( int i_fd, uint16_t i_pid ) = NULL;
+uint8_t (*pf_InputStatus)( uint8_t *p_answer, ssize_t *pi_size ) = NULL;
 
 /*****************************************************************************
  * Configuration files
@@ -175,6 +187,7 @@ void config_Free( output_config_t *p_config )
     dvb_string_clean( &p_config->provider_name );
     free( p_config->pi_pids );
     free( p_config->psz_srcaddr );
+    free( p_config->psz_path );
 }
 
 static void config_Defaults( output_config_t *p_config )
@@ -277,6 +290,29 @@ static void config_strdvb( dvb_string_t *p_dvb_string, const char *psz_string,
     free(p_iconv);
 }
 
+/* The path of a file or HTTP output may contain slashes, it ends at the
+ * first option, which is a flag or has an argument */
+static char *config_FileOptions( char *psz_path )
+{
+    static const char *ppsz_flags[] = { "udp", "dvb", "epg", "restamp",
+                                        "direct", NULL };
+    char *psz = psz_path;
+
+    while ( (psz = strchr( psz + 1, '/' )) != NULL )
+    {
+        size_t i_len = strcspn( psz + 1, "/" );
+        int i;
+
+        if ( memchr( psz + 1, '=', i_len ) != NULL )
+            return psz;
+        for ( i = 0; ppsz_flags[i] != NULL; i++ )
+            if ( i_len == strlen( ppsz_flags[i] )
+                  && !strncasecmp( psz + 1, ppsz_flags[i], i_len ) )
+                return psz;
+    }
+    return NULL;
+}
+
 static bool config_ParseHost( output_config_t *p_config, char *psz_string )
 {
     struct addrinfo *p_ai;
@@ -284,25 +320,55 @@ static bool config_ParseHost( output_config_t *p_config, char *psz_string )
 
     p_config->psz_displayname = strdup( psz_string );
 
-    p_ai = ParseNodeService( psz_string, &psz_string, DEFAULT_PORT );
-    if ( p_ai == NULL ) return false;
-    memcpy( &p_config->connect_addr, p_ai->ai_addr, p_ai->ai_addrlen );
-    freeaddrinfo( p_ai );
+    if ( !strncasecmp( psz_string, "file:", 5 ) )
+    {
+        char *psz_options = config_FileOptions( psz_string + 5 );
+
+        psz_string += 5;
+        if ( psz_options == NULL )
+            psz_options = psz_string + strlen( psz_string );
+        if ( psz_options == psz_string ) return false;
 
-    p_config->i_family = p_config->connect_addr.ss_family;
-    if ( p_config->i_family == AF_UNSPEC ) return false;
+        p_config->psz_path = strndup( psz_string, psz_options - psz_string );
+        p_config->i_config |= OUTPUT_FILE | OUTPUT_UDP;
+        psz_string = psz_options;
+    }
+    else if ( !strncasecmp( psz_string, "http:", 5 ) )
+    {
+        char *psz_options = config_FileOptions( psz_string + 5 );
 
-    if ( psz_string == NULL || !*psz_string ) goto end;
+        psz_string += 5;
+        if ( *psz_string != '/' ) return false;
+        if ( psz_options == NULL )
+            psz_options = psz_string + strlen( psz_string );
 
-    if ( *psz_string == '@' )
+        p_config->psz_path = strndup( psz_string, psz_options - psz_string );
+        p_config->i_config |= OUTPUT_HTTP | OUTPUT_UDP;
+        psz_string = psz_options;
+    }
+    else
     {
-        psz_string++;
-        p_ai = ParseNodeService( psz_string, &psz_string, 0 );
-        if ( p_ai == NULL || p_ai->ai_family != p_config->i_family )
-            msg_Warn( NULL, "invalid bind address" );
-        else
-            memcpy( &p_config->bind_addr, p_ai->ai_addr, p_ai->ai_addrlen );
+        p_ai = ParseNodeService( psz_string, &psz_string, DEFAULT_PORT );
+        if ( p_ai == NULL ) return false;
+        memcpy( &p_config->connect_addr, p_ai->ai_addr, p_ai->ai_addrlen );
         freeaddrinfo( p_ai );
+
+        p_config->i_family = p_config->connect_addr.ss_family;
+        if ( p_config->i_family == AF_UNSPEC ) return false;
+
+        if ( psz_string == NULL || !*psz_string ) goto end;
+
+        if ( *psz_string == '@' )
+        {
+            psz_string++;
+            p_ai = ParseNodeService( psz_string, &psz_string, 0 );
+            if ( p_ai == NULL || p_ai->ai_family != p_config->i_family )
+                msg_Warn( NULL, "invalid bind address" );
+            else
+                memcpy( &p_config->bind_addr, p_ai->ai_addr,
+                        p_ai->ai_addrlen );
+            freeaddrinfo( p_ai );
+        }
     }
 
     const char *psz_charset = psz_dvb_charset;
@@ -323,6 +389,30 @@ static bool config_ParseHost( output_config_t *p_config, char *psz_string )
             p_config->i_config |= OUTPUT_DVB;
         else if ( IS_OPTION("epg") )
             p_config->i_config |= OUTPUT_EPG;
+        else if ( IS_OPTION("gso") )
+            p_config->i_config |= OUTPUT_GSO;
+        else if ( IS_OPTION("txtime=tai") )
+        {
+            p_config->i_config |= OUTPUT_TXTIME;
+            p_config->b_txtime_tai = true;
+        }
+        else if ( IS_OPTION("txtime") )
+            p_config->i_config |= OUTPUT_TXTIME;
+        else if ( IS_OPTION("restamp") )
+            p_config->i_config |= OUTPUT_RESTAMP;
+        else if ( IS_OPTION("rotate=") )
+            p_config->i_rotate = strtol( ARG_OPTION("rotate="), NULL, 0 );
+        else if ( IS_OPTION("size=") )
+            p_config->i_rotate_size = strtoull( ARG_OPTION("size="), NULL, 0 )
+                                       * 1024 * 1024;
+        else if ( IS_OPTION("direct") )
+            p_config->b_direct = true;
+        else if ( IS_OPTION("rtcp") )
+            p_config->i_config |= OUTPUT_RTCP;
+        else if ( IS_OPTION("retx=") )
+            p_config->i_retx = strtoll( ARG_OPTION("retx="), NULL, 0 ) * 1000;
+        else if ( IS_OPTION("cbr=") )
+            p_config->i_cbr = strtoull( ARG_OPTION("cbr="), NULL, 0 );
         else if ( IS_OPTION("tsid=") )
             p_config->i_tsid = strtol( ARG_OPTION("tsid="), NULL, 0 );
         else if ( IS_OPTION("retention=") )
@@ -353,12 +443,19 @@ static bool config_ParseHost( output_config_t *p_config, char *psz_string )
             psz_provider_name = ARG_OPTION("srvprovider=");
         else if ( IS_OPTION("srcaddr=") )
         {
-            if ( p_config->i_family != AF_INET ) {
-                msg_Err( NULL, "RAW sockets currently implemented for ipv4 only");
-                return false;
-            }
+            struct in6_addr addr;
+
             free( p_config->psz_srcaddr );
             p_config->psz_srcaddr = config_stropt( ARG_OPTION("srcaddr=") );
+            if ( (p_config->i_family != AF_INET
+                   && p_config->i_family != AF_INET6)
+                  || p_config->psz_srcaddr == NULL
+                  || inet_pton( p_config->i_family, p_config->psz_srcaddr,
+                                &addr ) != 1 )
+            {
+                msg_Err( NULL, "invalid source address for RAW sockets" );
+                return false;
+            }
             p_config->i_config |= OUTPUT_RAW;
         }
         else if ( IS_OPTION("srcport=") )
@@ -457,6 +554,8 @@ void config_ReadFile(void)
         return;
     }
 
+    outputs_Lock();
+
     while ( fgets( psz_line, sizeof(psz_line), p_file ) != NULL )
     {
         output_config_t config;
@@ -563,6 +662,8 @@ void config_ReadFile(void)
         p_output->config.i_config &= ~OUTPUT_STILL_PRESENT;
         config_Free( &config );
     }
+
+    outputs_Unlock();
 }
 
 /*****************************************************************************
@@ -646,6 +747,13 @@ void usage()
     msg_Raw( NULL, "  -b --bandwidth        frontend bandwidth" );
 #endif
     msg_Raw( NULL, "  -D --rtp-input        read packets from a multicast address instead of a DVB card" );
+#ifdef HAVE_PACKET_MMAP
+    msg_Raw( NULL, "     --packet-input     read packets from a multicast address through a mapped AF_PACKET ring" );
+#endif
+    msg_Raw( NULL, "     --file-input       read packets from a TS file or pipe (- for stdin)" );
+    msg_Raw( NULL, "     --file-pace <pcr|fast> replay in real time from the PCR (default), or as fast as possible" );
+    msg_Raw( NULL, "     --file-loop        restart at the beginning of the file at end of file" );
+    msg_Raw( NULL, "     --dts-pcr-pid <pid|auto> date packets from the PCR of a PID (auto: first selected one)" );
 #ifdef HAVE_DVB_SUPPORT
     msg_Raw( NULL, "  -5 --delsys           delivery system" );
     msg_Raw( NULL, "    DVBS|DVBS2|DVBC_ANNEX_A|DVBT|DVBT2|ATSC|ISDBT|DVBC_ANNEX_B(ATSC-C/QAMB) (default guessed)");
@@ -683,6 +791,7 @@ void usage()
     msg_Raw( NULL, "  -O --lock-timeout     timeout for the lock operation (in ms)" );
     msg_Raw( NULL, "  -y --ca-number <ca_device_number>" );
     msg_Raw( NULL, "  -2 --dvr-buf-size <size> set the size of the DVR TS buffer in bytes (default: %d)", i_dvr_buffer_size);
+    msg_Raw( NULL, "     --dvr-buf-max <size> grow the DVR TS buffer up to this size on overflows (default: %d)", i_dvr_buffer_max);
 #endif
 
     msg_Raw( NULL, "Output:" );
@@ -702,6 +811,11 @@ void usage()
     msg_Raw( NULL, "  -t --ttl <ttl>        TTL of the output stream" );
     msg_Raw( NULL, "  -T --unique-ts-id     generate random unique TS ID for each output" );
     msg_Raw( NULL, "  -U --udp              use raw UDP rather than RTP (required by some IPTV set top boxes)" );
+    msg_Raw( NULL, "     --output-engine <writev|io_uring> system interface used to send the outputs (default: writev)" );
+    msg_Raw( NULL, "     --output-threads <n> send the outputs from n threads (default: 0, main thread)" );
+    msg_Raw( NULL, "     --http-listen <host:port> serve the http: outputs to HTTP clients" );
+    msg_Raw( NULL, "     --pool-size <MB>   memory preallocated for packets and blocks (default: 4, 0 disables)" );
+    msg_Raw( NULL, "     --pool-hugepages   map the memory pool on 2 MB hugepages" );
     msg_Raw( NULL, "  -z --any-type         pass through all ESs from the PMT, of any type" );
     msg_Raw( NULL, "  -0 --pidmap <pmt_pid,audio_pid,video_pid,spu_pid>");
 
@@ -772,6 +886,17 @@ int main( int i_argc, char **pp_argv )
         { "multistream-id-pls-mode",  required_argument, NULL, 0x100001 },
         { "multistream-id-pls-code",  required_argument, NULL, 0x100002 },
         { "multistream-id-is-id"   ,  required_argument, NULL, 0x100003 },
+        { "packet-input",    required_argument, NULL, 0x100004 },
+        { "dts-pcr-pid",     required_argument, NULL, 0x100005 },
+        { "file-input",      required_argument, NULL, 0x100006 },
+        { "file-pace",       required_argument, NULL, 0x100007 },
+        { "file-loop",       no_argument,       NULL, 0x100008 },
+        { "dvr-buf-max",     required_argument, NULL, 0x100009 },
+        { "output-engine",   required_argument, NULL, 0x10000A },
+        { "output-threads",  required_argument, NULL, 0x10000B },
+        { "http-listen",     required_argument, NULL, 0x10000C },
+        { "pool-size",       required_argument, NULL, 0x10000D },
+        { "pool-hugepages",  no_argument,       NULL, 0x10000E },
         { "fec-lp",          required_argument, NULL, 'K' },
         { "guard",           required_argument, NULL, 'G' },
         { "hierarchy",       required_argument, NULL, 'H' },
@@ -1038,6 +1163,12 @@ int main( int i_argc, char **pp_argv )
             break;
 
         case 'D':
+            if ( pf_Open == udp_Open && psz_udp_src2 == NULL )
+            {
+                /* A second -D is the redundant path */
+                psz_udp_src2 = optarg;
+                break;
+            }
             psz_udp_src = optarg;
             if ( pf_Open != NULL )
                 usage();
@@ -1045,6 +1176,102 @@ int main( int i_argc, char **pp_argv )
             pf_Reset = udp_Reset;
             pf_SetFilter = udp_SetFilter;
             pf_UnsetFilter = udp_UnsetFilter;
+            pf_InputStatus = udp_InputStatus;
+            break;
+
+        case 0x100004: // --packet-input
+#ifdef HAVE_PACKET_MMAP
+            psz_packet_src = optarg;
+            if ( pf_Open != NULL )
+                usage();
+            pf_Open = packet_Open;
+            pf_Reset = packet_Reset;
+            pf_SetFilter = packet_SetFilter;
+            pf_UnsetFilter = packet_UnsetFilter;
+            pf_InputStatus = packet_InputStatus;
+#else
+            msg_Err( NULL, "DVBlast is compiled without packet ring support.");
+            exit(1);
+#endif
+            break;
+
+        case 0x100005: // --dts-pcr-pid
+            if ( streq( optarg, "auto" ) )
+                i_dts_pcr_pid = MAX_PIDS;
+            else
+            {
+                i_dts_pcr_pid = strtol( optarg, NULL, 0 );
+                if ( i_dts_pcr_pid < 0 || i_dts_pcr_pid >= PADDING_PID ) {
+                    msg_Err(NULL, "ERROR: Invalid --dts-pcr-pid '%s', valid options are: 0-8190 auto", optarg);
+                    exit(1);
+                }
+            }
+            break;
+
+        case 0x100006: // --file-input
+            psz_file_src = optarg;
+            if ( pf_Open != NULL )
+                usage();
+            pf_Open = file_Open;
+            pf_Reset = file_Reset;
+            pf_SetFilter = file_SetFilter;
+            pf_UnsetFilter = file_UnsetFilter;
+            break;
+
+        case 0x100007: // --file-pace
+            if ( streq( optarg, "pcr" ) )
+                b_file_fast = false;
+            else if ( streq( optarg, "fast" ) )
+                b_file_fast = true;
+            else {
+                msg_Err(NULL, "ERROR: Invalid --file-pace '%s', valid options are: pcr fast", optarg);
+                exit(1);
+            }
+            break;
+
+        case 0x100008: // --file-loop
+            b_file_loop = true;
+            break;
+
+        case 0x10000B: // --output-threads
+            i_output_threads = strtol( optarg, NULL, 0 );
+            if ( i_output_threads < 0 )
+                usage();  // it exits
+            break;
+
+        case 0x10000C: // --http-listen
+            psz_http_listen = optarg;
+            break;
+
+        case 0x10000D: // --pool-size
+        {
+            long i_mb = strtol( optarg, NULL, 0 );
+            if ( i_mb < 0 )
+                usage();  // it exits
+            i_pool_size = (size_t)i_mb * 1024 * 1024;
+            break;
+        }
+
+        case 0x10000E: // --pool-hugepages
+            b_pool_hugepages = true;
+            break;
+
+        case 0x10000A: // --output-engine
+            if ( streq( optarg, "writev" ) )
+                b_io_uring = false;
+            else if ( streq( optarg, "io_uring" ) )
+            {
+#ifdef HAVE_IO_URING
+                b_io_uring = true;
+#else
+                msg_Err( NULL, "DVBlast is compiled without io_uring support.");
+                exit(1);
+#endif
+            }
+            else {
+                msg_Err(NULL, "ERROR: Invalid --output-engine '%s', valid options are: writev io_uring", optarg);
+                exit(1);
+            }
             break;
 
         case 'A':
@@ -1200,6 +1427,12 @@ int main( int i_argc, char **pp_argv )
             i_dvr_buffer_size /= TS_SIZE;
             i_dvr_buffer_size *= TS_SIZE;
             break;
+
+        case 0x100009: // --dvr-buf-max
+            i_dvr_buffer_max = strtol( optarg, NULL, 0 );
+            if ( i_dvr_buffer_max <= 0 )
+                usage();  // it exits
+            break;
 #endif
         case 'h':
         default:
@@ -1251,6 +1484,12 @@ int main( int i_argc, char **pp_argv )
         exit(EXIT_FAILURE);
     }
 
+    /* Blocks get half of the memory pool, packets the other half */
+    block_Init( i_pool_size / 2, b_pool_hugepages );
+    outputs_Init();
+    if ( psz_http_listen != NULL )
+        http_Open( psz_http_listen );
+
     memset( &output_dup, 0, sizeof(output_dup) );
     if ( psz_dup_config != NULL )
     {
@@ -1261,8 +1500,10 @@ int main( int i_argc, char **pp_argv )
             msg_Err( NULL, "Invalid target address for -d switch" );
         else
         {
+            outputs_Lock();
             output_Init( &output_dup, &config );
             output_Change( &output_dup, &config );
+            outputs_Unlock();
         }
 
         config_Free( &config );
@@ -1327,12 +1568,11 @@ int main( int i_argc, char **pp_argv )
         ev_timer_start(event_loop, &quit_watcher);
     }
 
-    outputs_Init();
-
     ev_run(event_loop, 0);
 
     mrtgClose();
     outputs_Close( i_nb_outputs );
+    http_Close();
     demux_Close();
     dvb_string_clean( &network_name );
     dvb_string_clean( &provider_name );
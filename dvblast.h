@@ -24,9 +24,11 @@
 #include <netdb.h>
 #include <sys/socket.h>
 #include <sys/types.h> /* u_int16_t */
+#include <sys/uio.h>
 #include <netinet/udp.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
+#include <netinet/ip6.h>
 
 #include "config.h"
 
@@ -79,16 +81,26 @@ struct udprawpkt {
     uint8_t payload[];
 } __attribute__((packed));
 
+struct udpraw6pkt {
+    struct  ip6_hdr ip6h;
+    struct  udpheader udph;
+} __attribute__((packed));
+
 /*****************************************************************************
  * Output configuration flags (for output_t -> i_config) - bit values
  * Bit  0 : Set for watch mode
  * Bit  1 : Set output still present
  * Bit  2 : Set if output is valid (replaces m_addr != 0 tests)
  * Bit  3 : Set for UDP, otherwise use RTP if a network stream
- * Bit  4 : Set for file / FIFO output, unset for network (future use)
+ * Bit  4 : Set for file output, unset for network
  * Bit  5 : Set if DVB conformance tables are inserted
  * Bit  6 : Set if DVB EIT schedule tables are forwarded
  * Bit  7 : Set for RAW socket output
+ * Bit  8 : Set to send several datagrams per call with UDP GSO
+ * Bit  9 : Set to let the kernel pace datagrams with SO_TXTIME
+ * Bit 10 : Set to correct PCRs for the time spent in the output queue
+ * Bit 11 : Set for HTTP output, served to the clients of the HTTP server
+ * Bit 12 : Set to send RTCP sender reports and read receiver reports
  *****************************************************************************/
 
 #define OUTPUT_WATCH         0x01
@@ -99,6 +111,11 @@ struct udprawpkt {
 #define OUTPUT_DVB           0x20
 #define OUTPUT_EPG           0x40
 #define OUTPUT_RAW           0x80
+#define OUTPUT_GSO           0x100
+#define OUTPUT_TXTIME        0x200
+#define OUTPUT_RESTAMP       0x400
+#define OUTPUT_HTTP          0x800
+#define OUTPUT_RTCP          0x1000
 
 typedef int64_t mtime_t;
 
@@ -107,11 +124,17 @@ typedef struct block_t
     uint8_t p_ts[TS_SIZE];
     int i_refcount;
     mtime_t i_dts;
-    uint16_t tmp_pid;
     struct block_t *p_next;
 } block_t;
 
 typedef struct packet_t packet_t;
+typedef struct record_t record_t;
+typedef struct http_stream_t http_stream_t;
+typedef struct output_retx_t output_retx_t;
+typedef struct output_rtcp_t output_rtcp_t;
+typedef struct output_worker_t output_worker_t;
+typedef struct pool_t pool_t;
+struct ret_pool;
 
 typedef struct dvb_string_t
 {
@@ -143,6 +166,15 @@ typedef struct output_config_t
     int i_mtu;
     char *psz_srcaddr; /* raw packets */
     int i_srcport;
+    bool b_txtime_tai; /* SO_TXTIME clock for the ETF qdisc */
+    uint64_t i_cbr; /* bits per second, 0 for VBR */
+    mtime_t i_retx; /* retransmission history, 0 to disable */
+
+    /* file and HTTP outputs */
+    char *psz_path; /* strftime() pattern, or request path */
+    time_t i_rotate; /* seconds per file, 0 for no rotation */
+    uint64_t i_rotate_size; /* bytes per file, 0 for no limit */
+    bool b_direct; /* O_DIRECT writes */
 
     /* demux config */
     int i_tsid;
@@ -168,6 +200,19 @@ typedef struct output_t
     packet_t *p_packet_lifo;
     unsigned int i_packet_count;
     uint16_t i_seqnum;
+    bool b_gso; /* UDP_SEGMENT accepted by the socket */
+    bool b_txtime; /* SO_TXTIME accepted by the socket */
+    int i_uring_file; /* io_uring fixed file, -1 for writev */
+    output_worker_t *p_worker; /* sender thread, NULL for the main thread */
+    record_t *p_record; /* file outputs */
+    http_stream_t *p_stream; /* HTTP outputs */
+    output_retx_t *p_retx; /* RTP retransmission, NULL if disabled */
+    output_rtcp_t *p_rtcp; /* RTCP socket, NULL if disabled */
+    int i_heap_index; /* in the send heap, -1 if there is nothing to send */
+    mtime_t i_heap_date; /* not after the date the first packet is due */
+    mtime_t i_cbr_date; /* date of the next CBR packet, -1 to start */
+    uint64_t i_cbr_frac; /* remainder of i_cbr_date, in 1/i_cbr us */
+    bool b_cbr_overflow;
 
     /* demux */
     int i_nb_errors;
@@ -191,6 +236,8 @@ typedef struct output_t
     uint16_t pi_freepids[MAX_PIDS];   // used where multiple streams of the same type are used
 
     struct udprawpkt raw_pkt_header;
+    struct udpraw6pkt raw6_pkt_header; /* template of the IPv6 outputs */
+    uint64_t i_raw6_csum; /* UDP checksum of the pseudo-header and ports */
 } output_t;
 
 typedef struct ts_pid_info {
@@ -220,6 +267,7 @@ extern int i_fenum;
 extern int i_canum;
 extern char *psz_delsys;
 extern int i_dvr_buffer_size;
+extern int i_dvr_buffer_max;
 extern int i_frequency;
 extern char *psz_lnb_type;
 extern int i_srate;
@@ -255,8 +303,17 @@ extern int b_random_tsid;
 extern int dvb_plp_id;
 extern bool b_enable_emm;
 extern bool b_enable_ecm;
-extern mtime_t i_wallclock;
+extern __thread mtime_t i_wallclock; /* per sender thread */
 extern char *psz_udp_src;
+extern char *psz_udp_src2;
+extern char *psz_packet_src;
+extern char *psz_file_src;
+extern bool b_file_fast;
+extern bool b_file_loop;
+extern bool b_io_uring;
+extern int i_output_threads;
+extern size_t i_pool_size;
+extern bool b_pool_hugepages;
 extern int i_asi_adapter;
 extern const char *psz_native_charset;
 extern enum print_type_t i_print_type;
@@ -265,6 +322,7 @@ extern FILE *print_fh;
 extern mtime_t i_print_period;
 extern mtime_t i_es_timeout;
 extern mtime_t i_udp_lock_timeout;
+extern int i_dts_pcr_pid;
 
 /* pid mapping */
 extern bool b_do_remap;
@@ -275,6 +333,7 @@ extern void (*pf_Open)( void );
 extern void (*pf_Reset)( void );
 extern int (*pf_SetFilter)( uint16_t i_pid );
 extern void (*pf_UnsetFilter)( int i_fd, uint16_t i_pid );
+extern uint8_t (*pf_InputStatus)( uint8_t *p_answer, ssize_t *pi_size );
 
 /*****************************************************************************
  * Prototypes
@@ -304,6 +363,7 @@ void dvb_string_copy(dvb_string_t *p_dst, const dvb_string_t *p_src);
 int dvb_string_cmp(const dvb_string_t *p_1, const dvb_string_t *p_2);
 
 mtime_t mdate( void );
+mtime_t mdate_Forward( mtime_t i_date );
 void msleep( mtime_t delay );
 void hexDump( uint8_t *p_data, uint32_t i_len );
 struct addrinfo *ParseNodeService( char *_psz_string, char **ppsz_end,
@@ -320,11 +380,33 @@ void dvb_Reset( void );
 int dvb_SetFilter( uint16_t i_pid );
 void dvb_UnsetFilter( int i_fd, uint16_t i_pid );
 uint8_t dvb_FrontendStatus( uint8_t *p_answer, ssize_t *pi_size );
+uint8_t dvb_DVRStatus( uint8_t *p_answer, ssize_t *pi_size );
 
 void udp_Open( void );
 void udp_Reset( void );
 int udp_SetFilter( uint16_t i_pid );
 void udp_UnsetFilter( int i_fd, uint16_t i_pid );
+uint8_t udp_InputStatus( uint8_t *p_answer, ssize_t *pi_size );
+
+#ifdef HAVE_PACKET_MMAP
+void packet_Open( void );
+void packet_Reset( void );
+int packet_SetFilter( uint16_t i_pid );
+void packet_UnsetFilter( int i_fd, uint16_t i_pid );
+uint8_t packet_InputStatus( uint8_t *p_answer, ssize_t *pi_size );
+#endif
+
+ssize_t tssync_Find( const uint8_t *p_data, size_t i_len,
+                     unsigned int *pi_size );
+block_t **tssync_Run( block_t *p_blocks, size_t i_len, bool b_stream,
+                      block_t **pp_current );
+block_t **tssync_RunBuffer( const uint8_t *p_data, size_t i_len,
+                            bool b_stream, block_t **pp_current );
+
+void file_Open( void );
+void file_Reset( void );
+int file_SetFilter( uint16_t i_pid );
+void file_UnsetFilter( int i_fd, uint16_t i_pid );
 
 void asi_Open( void );
 void asi_Reset( void );
@@ -338,8 +420,29 @@ int asi_deltacast_SetFilter( uint16_t i_pid );
 void asi_deltacast_UnsetFilter( int i_fd, uint16_t i_pid );
 #endif
 
+#ifdef HAVE_IO_URING
+int uring_AddFile( int i_fd );
+void uring_DelFile( int i_index );
+int uring_Queue( int i_index, const struct iovec *p_iov, int i_iov );
+int uring_Submit( void );
+void uring_Close( void );
+#endif
+
+record_t *record_Open( const output_config_t *p_config );
+void record_Change( record_t *p_record, const output_config_t *p_config );
+void record_Write( record_t *p_record, const struct iovec *p_iov, int i_iov );
+void record_Close( record_t *p_record );
+
+void http_Open( const char *psz_address );
+http_stream_t *http_StreamOpen( const output_config_t *p_config );
+void http_StreamWrite( http_stream_t *p_stream, const struct iovec *p_iov,
+                       int i_iov );
+void http_StreamClose( http_stream_t *p_stream );
+void http_Close( void );
+
 void demux_Open( void );
 void demux_Run( block_t *p_ts );
+void demux_RunDated( block_t *p_ts );
 void demux_Change( output_t *p_output, const output_config_t *p_config );
 void demux_ResendCAPMTs( void );
 bool demux_PIDIsSelected( uint16_t i_pid );
@@ -365,12 +468,27 @@ output_t *output_Find( const output_config_t *p_config );
 void output_Change( output_t *p_output, const output_config_t *p_config );
 void outputs_Init( void );
 void outputs_Close( int i_num_outputs );
+void outputs_Wake( void );
+void outputs_Lock( void );
+void outputs_Unlock( void );
+uint8_t outputs_Status( uint8_t *p_answer, ssize_t *pi_size );
+uint8_t outputs_RTCPStatus( uint8_t *p_answer, ssize_t *pi_size );
+void outputs_PoolStatus( struct ret_pool *p_ret );
 
 void comm_Open( void );
 void comm_Close( void );
 
+pool_t *pool_New( size_t i_slot_size, size_t i_size, bool b_hugepages,
+                  bool b_shared );
+void *pool_Alloc( pool_t *p_pool, size_t i_size );
+void pool_Free( pool_t *p_pool, void *p_slot );
+void pool_Delete( pool_t *p_pool );
+void pool_Status( pool_t *p_pool, struct ret_pool *p_ret );
+
+void block_Init( size_t i_size, bool b_hugepages );
 block_t *block_New( void );
 void block_Delete( block_t *p_block );
+void block_Status( struct ret_pool *p_ret );
 void block_Vacuum( void );
 
 /*****************************************************************************
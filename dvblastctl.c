@@ -331,6 +331,7 @@ static const struct dvblastctl_option options[] =
 
     { "fe_status",          0, CMD_FRONTEND_STATUS },
     { "mmi_status",         0, CMD_MMI_STATUS },
+    { "dvr_status",         0, CMD_GET_DVR_STATUS },
 
     { "mmi_slot_status",    1, CMD_MMI_SLOT_STATUS }, /* arg: slot */
     { "mmi_open",           1, CMD_MMI_OPEN },        /* arg: slot */
@@ -348,6 +349,10 @@ static const struct dvblastctl_option options[] =
     { "get_pmt",            1, CMD_GET_PMT }, /* arg: service_id (uint16_t) */
     { "get_pids",           0, CMD_GET_PIDS },
     { "get_pid",            1, CMD_GET_PID },  /* arg: pid (uint16_t) */
+    { "input_status",       0, CMD_GET_INPUT_STATUS },
+    { "output_status",      0, CMD_GET_OUTPUT_STATUS },
+    { "rtcp_status",        0, CMD_GET_RTCP_STATUS },
+    { "pool_status",        0, CMD_GET_POOL_STATUS },
 
     { NULL, 0, 0 }
 };
@@ -368,6 +373,7 @@ void usage()
     printf("Status commands:\n");
     printf("  fe_status                       Read frontend status information.\n");
     printf("  mmi_status                      Read CAM status.\n");
+    printf("  dvr_status                      Read DVR read size statistics.\n");
     printf("MMI commands:\n");
     printf("  mmi_slot_status <slot>          Read MMI slot status.\n");
     printf("  mmi_open <slot>                 Open MMI slot.\n");
@@ -386,6 +392,10 @@ void usage()
     printf("  get_pmt <service_id>            Return last PMT table.\n");
     printf("  get_pids                        Return info about all pids.\n");
     printf("  get_pid <pid>                   Return info for chosen pid only.\n");
+    printf("  input_status                    Return input statistics.\n");
+    printf("  output_status                   Return output batching statistics.\n");
+    printf("  rtcp_status                     Return RTCP statistics of the outputs.\n");
+    printf("  pool_status                     Return memory pool statistics.\n");
     printf("\n");
     exit(1);
 }
@@ -539,6 +549,11 @@ int main( int i_argc, char **ppsz_argv )
     case CMD_GET_NIT:
     case CMD_GET_SDT:
     case CMD_GET_PIDS:
+    case CMD_GET_INPUT_STATUS:
+    case CMD_GET_DVR_STATUS:
+    case CMD_GET_OUTPUT_STATUS:
+    case CMD_GET_RTCP_STATUS:
+    case CMD_GET_POOL_STATUS:
         /* These commands need no special handling because they have no parameters */
         break;
     case CMD_GET_EIT_PF:
@@ -734,6 +749,141 @@ int main( int i_argc, char **ppsz_argv )
         break;
     }
 
+    case RET_INPUT_STATUS:
+    {
+        struct ret_input_status *p_ret =
+            (struct ret_input_status *)&p_buffer[COMM_HEADER_SIZE];
+        if ( i_packet_size != COMM_HEADER_SIZE + sizeof(struct ret_input_status) )
+            return_error( "Bad input status" );
+
+        if ( i_print_type == PRINT_XML )
+            printf("<INPUT lost=\"%"PRIu64"\">\n", p_ret->i_lost);
+        else
+            printf("lost: %"PRIu64"\n", p_ret->i_lost);
+
+        for ( i = 0; i < p_ret->i_nb_paths && i < INPUT_MAX_PATHS; i++ )
+        {
+            struct ret_input_path *p_path = &p_ret->paths[i];
+            if ( i_print_type == PRINT_XML )
+                printf(" <PATH index=\"%u\" datagrams=\"%"PRIu64"\" forwarded=\"%"PRIu64"\" lost=\"%"PRIu64"\" dropped=\"%"PRIu64"\"/>\n",
+                       i, p_path->i_datagrams, p_path->i_forwarded,
+                       p_path->i_lost, p_path->i_dropped);
+            else
+                printf("path %u datagrams %"PRIu64" forwarded %"PRIu64" lost %"PRIu64" dropped %"PRIu64"\n",
+                       i, p_path->i_datagrams, p_path->i_forwarded,
+                       p_path->i_lost, p_path->i_dropped);
+        }
+
+        if ( i_print_type == PRINT_XML )
+            printf("</INPUT>\n");
+        break;
+    }
+
+    case RET_OUTPUT_STATUS:
+    {
+        struct ret_output_status *p_ret =
+            (struct ret_output_status *)&p_buffer[COMM_HEADER_SIZE];
+        if ( i_packet_size != COMM_HEADER_SIZE + sizeof(struct ret_output_status) )
+            return_error( "Bad output status" );
+
+        if ( i_print_type == PRINT_XML )
+            printf("<OUTPUT syscalls=\"%"PRIu64"\" datagrams=\"%"PRIu64"\" max_batch=\"%"PRIu32"\">\n",
+                   p_ret->i_syscalls, p_ret->i_datagrams, p_ret->i_max_batch);
+        else
+            printf("syscalls: %"PRIu64" datagrams: %"PRIu64" max batch: %"PRIu32"\n",
+                   p_ret->i_syscalls, p_ret->i_datagrams, p_ret->i_max_batch);
+
+        for ( i = 0; i < OUTPUT_HISTOGRAM_SIZE; i++ )
+        {
+            unsigned int i_min = 1U << i;
+            unsigned int i_max = (2U << i) - 1;
+
+            if ( i_print_type == PRINT_XML )
+                printf(" <CALLS min=\"%u\" max=\"%u\" count=\"%"PRIu64"\"/>\n",
+                       i_min, i_max, p_ret->pi_histogram[i]);
+            else
+                printf("%u-%u datagrams: %"PRIu64"\n",
+                       i_min, i_max, p_ret->pi_histogram[i]);
+        }
+
+        if ( i_print_type == PRINT_XML )
+            printf("</OUTPUT>\n");
+        break;
+    }
+
+    case RET_RTCP_STATUS:
+    {
+        struct ret_rtcp_status *p_ret =
+            (struct ret_rtcp_status *)&p_buffer[COMM_HEADER_SIZE];
+        if ( i_packet_size < COMM_HEADER_SIZE + sizeof(struct ret_rtcp_status)
+              || i_packet_size != COMM_HEADER_SIZE
+                   + sizeof(struct ret_rtcp_status)
+                   + p_ret->i_nb_outputs * sizeof(struct ret_rtcp_output) )
+            return_error( "Bad RTCP status" );
+
+        if ( i_print_type == PRINT_XML )
+            printf("<RTCP>\n");
+
+        for ( i = 0; i < (int)p_ret->i_nb_outputs; i++ )
+        {
+            struct ret_rtcp_output *p_entry = &p_ret->p_outputs[i];
+
+            if ( i_print_type == PRINT_XML )
+                printf(" <OUTPUT name=\"%s\" packets=\"%"PRIu64"\" octets=\"%"PRIu64"\" retransmitted=\"%"PRIu64"\" reports=\"%"PRIu64"\" report_age=\"%"PRId64"\" fraction_lost=\"%u\" lost=\"%"PRId32"\" jitter=\"%"PRId64"\" rtt=\"%"PRId64"\"/>\n",
+                       p_entry->psz_name, p_entry->i_packets,
+                       p_entry->i_octets, p_entry->i_retransmitted,
+                       p_entry->i_reports, p_entry->i_report_age,
+                       p_entry->i_fraction_lost, p_entry->i_cumulative_lost,
+                       p_entry->i_jitter, p_entry->i_rtt);
+            else
+                printf("%s: packets: %"PRIu64" octets: %"PRIu64" retransmitted: %"PRIu64" reports: %"PRIu64" last report: %"PRId64" us ago loss: %.1f%% lost: %"PRId32" jitter: %"PRId64" us rtt: %"PRId64" us\n",
+                       p_entry->psz_name, p_entry->i_packets,
+                       p_entry->i_octets, p_entry->i_retransmitted,
+                       p_entry->i_reports, p_entry->i_report_age,
+                       p_entry->i_fraction_lost * 100. / 256,
+                       p_entry->i_cumulative_lost, p_entry->i_jitter,
+                       p_entry->i_rtt);
+        }
+
+        if ( i_print_type == PRINT_XML )
+            printf("</RTCP>\n");
+        break;
+    }
+
+    case RET_POOL_STATUS:
+    {
+        struct ret_pool_status *p_ret =
+            (struct ret_pool_status *)&p_buffer[COMM_HEADER_SIZE];
+        struct ret_pool *pp_pools[2] = { &p_ret->blocks, &p_ret->packets };
+        const char *ppsz_names[2] = { "blocks", "packets" };
+        if ( i_packet_size != COMM_HEADER_SIZE + sizeof(struct ret_pool_status) )
+            return_error( "Bad pool status" );
+
+        if ( i_print_type == PRINT_XML )
+            printf("<POOLS>\n");
+
+        for ( i = 0; i < 2; i++ )
+        {
+            struct ret_pool *p_pool = pp_pools[i];
+
+            if ( i_print_type == PRINT_XML )
+                printf(" <POOL name=\"%s\" slot_size=\"%"PRIu32"\" slots=\"%"PRIu32"\" used=\"%"PRIu32"\" high_water=\"%"PRIu32"\" exhausted=\"%"PRIu64"\" hugepages=\"%u\"/>\n",
+                       ppsz_names[i], p_pool->i_slot_size, p_pool->i_slots,
+                       p_pool->i_used, p_pool->i_high_water,
+                       p_pool->i_exhausted, p_pool->b_hugepages);
+            else
+                printf("%s: slot size: %"PRIu32" slots: %"PRIu32" used: %"PRIu32" high water: %"PRIu32" exhausted: %"PRIu64"%s\n",
+                       ppsz_names[i], p_pool->i_slot_size, p_pool->i_slots,
+                       p_pool->i_used, p_pool->i_high_water,
+                       p_pool->i_exhausted,
+                       p_pool->b_hugepages ? " (hugepages)" : "");
+        }
+
+        if ( i_print_type == PRINT_XML )
+            printf("</POOLS>\n");
+        break;
+    }
+
 #ifdef HAVE_DVB_SUPPORT
     case RET_FRONTEND_STATUS:
     {
@@ -877,6 +1027,15 @@ int main( int i_argc, char **ppsz_argv )
             ret = 0;
         }
 
+        if ( i_print_type == PRINT_XML )
+        {
+            printf(" <VALUE dvr_overflows=\"%"PRIu64"\"/>\n", p_ret->i_dvr_overflows);
+            printf(" <VALUE dvr_buffer_size=\"%"PRIu32"\"/>\n", p_ret->i_dvr_buffer_size);
+        } else {
+            printf("DVR overflows: %"PRIu64"\n", p_ret->i_dvr_overflows);
+            printf("DVR buffer size: %"PRIu32"\n", p_ret->i_dvr_buffer_size);
+        }
+
         if ( i_print_type == PRINT_XML )
             printf("</FRONTEND>\n" );
 
@@ -884,6 +1043,40 @@ int main( int i_argc, char **ppsz_argv )
         break;
     }
 
+    case RET_DVR_STATUS:
+    {
+        struct ret_dvr_status *p_ret =
+            (struct ret_dvr_status *)&p_buffer[COMM_HEADER_SIZE];
+        if ( i_packet_size != COMM_HEADER_SIZE + sizeof(struct ret_dvr_status) )
+            return_error( "Bad DVR status" );
+
+        if ( i_print_type == PRINT_XML )
+            printf("<DVR batch=\"%"PRIu32"\" max_batch=\"%"PRIu32"\" reads=\"%"PRIu64"\" packets=\"%"PRIu64"\">\n",
+                   p_ret->i_batch, p_ret->i_max_batch, p_ret->i_reads,
+                   p_ret->i_packets);
+        else
+            printf("batch: %"PRIu32" max batch: %"PRIu32" reads: %"PRIu64" packets: %"PRIu64"\n",
+                   p_ret->i_batch, p_ret->i_max_batch, p_ret->i_reads,
+                   p_ret->i_packets);
+
+        for ( i = 0; i < DVR_HISTOGRAM_SIZE; i++ )
+        {
+            unsigned int i_min = i ? 1U << i : 0;
+            unsigned int i_max = (2U << i) - 1;
+
+            if ( i_print_type == PRINT_XML )
+                printf(" <READS min=\"%u\" max=\"%u\" count=\"%"PRIu64"\"/>\n",
+                       i_min, i_max, p_ret->pi_histogram[i]);
+            else
+                printf("%u-%u packets: %"PRIu64"\n",
+                       i_min, i_max, p_ret->pi_histogram[i]);
+        }
+
+        if ( i_print_type == PRINT_XML )
+            printf("</DVR>\n");
+        break;
+    }
+
     case RET_MMI_STATUS:
     {
         struct ret_mmi_status *p_ret =
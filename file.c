@@ -0,0 +1,492 @@
+/*****************************************************************************
+ * file.c: transport stream file input for DVBlast
+ *****************************************************************************
+ * Copyright (C) 2026 VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <ev.h>
+
+#include <bitstream/common.h>
+#include <bitstream/mpeg/ts.h>
+
+#include "dvblast.h"
+
+/*****************************************************************************
+ * Local declarations
+ *****************************************************************************/
+#define FILE_BUFFER_SIZE (TS_SIZE * 16384) /* 3 MB */
+#define FILE_MAX_CHUNK 16384 /* packets */
+#define FILE_MAX_PCR_GAP (27000000 * 1) /* 1 s */
+#define FILE_MAX_LATE 1000000 /* 1 s */
+#define PCR_WRAP ((UINT64_C(1) << 33) * 300)
+
+static int i_handle = -1;
+static const uint8_t *p_map = NULL;
+static uint8_t *p_buffer = NULL;
+static size_t i_size = 0, i_pos = 0;
+static bool b_eof = false;
+static bool b_ts_sync = true;
+static unsigned int i_packet_size = TS_SIZE;
+static bool b_sync = false;
+static struct ev_io file_watcher;
+static struct ev_idle idle_watcher;
+static struct ev_timer pace_watcher;
+
+/* Packets are released in chunks ending on a PCR, at the date of the PCR */
+static block_t *p_chunk = NULL, **pp_chunk_current = &p_chunk;
+static int i_chunk_packets = 0;
+static bool b_chunk_ready = false;
+static bool b_chunk_undated = false; /* no PCR in FILE_MAX_CHUNK packets */
+static mtime_t i_chunk_date, i_last_date;
+
+static uint16_t i_pcr_pid = PADDING_PID;
+static bool b_pcr = false;
+static uint64_t i_last_pcr, i_pcr_ticks, i_base_ticks;
+static mtime_t i_base_date;
+
+static mtime_t i_start, i_skipped = 0;
+static uint64_t i_nb_packets = 0;
+
+/*****************************************************************************
+ * Local prototypes
+ *****************************************************************************/
+static void file_ReadCb(struct ev_loop *loop, struct ev_io *w, int revents);
+static void file_IdleCb(struct ev_loop *loop, struct ev_idle *w, int revents);
+static void file_PaceCb(struct ev_loop *loop, struct ev_timer *w, int revents);
+static void file_Run( void );
+static bool file_ReadChunk( void );
+static const uint8_t *file_NextPacket( void );
+static bool file_HandlePCR( const uint8_t *p_ts );
+static void file_SendChunk( void );
+static void file_End( void );
+
+/*****************************************************************************
+ * file_Open
+ *****************************************************************************/
+void file_Open( void )
+{
+    struct stat st;
+
+    if ( !strcmp( psz_file_src, "-" ) )
+        i_handle = STDIN_FILENO;
+    else if ( (i_handle = open( psz_file_src, O_RDONLY )) < 0 )
+    {
+        msg_Err( NULL, "couldn't open %s (%s)", psz_file_src,
+                 strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+
+    /* Regular files are mapped, pipes are read into a large buffer */
+    if ( fstat( i_handle, &st ) == 0 && S_ISREG(st.st_mode) && st.st_size )
+    {
+        p_map = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, i_handle, 0 );
+        if ( p_map == MAP_FAILED )
+        {
+            msg_Warn( NULL, "couldn't map %s (%s)", psz_file_src,
+                      strerror(errno) );
+            p_map = NULL;
+        }
+        else
+        {
+            i_size = st.st_size;
+            madvise( (void *)p_map, i_size, MADV_SEQUENTIAL );
+        }
+    }
+
+    if ( p_map == NULL )
+    {
+        if ( b_file_loop )
+        {
+            msg_Warn( NULL, "only regular files can be looped" );
+            b_file_loop = false;
+        }
+        p_buffer = malloc( FILE_BUFFER_SIZE );
+        fcntl( i_handle, F_SETFL, fcntl( i_handle, F_GETFL ) | O_NONBLOCK );
+        ev_io_init(&file_watcher, file_ReadCb, i_handle, EV_READ);
+    }
+
+    msg_Dbg( NULL, "reading %s %s", psz_file_src,
+             b_file_fast ? "as fast as possible" : "in real time" );
+
+    i_start = i_last_date = mdate();
+
+    ev_idle_init(&idle_watcher, file_IdleCb);
+    ev_timer_init(&pace_watcher, file_PaceCb, 0., 0.);
+    if ( b_file_fast )
+        ev_idle_start(event_loop, &idle_watcher);
+    else
+        ev_timer_start(event_loop, &pace_watcher);
+}
+
+/*****************************************************************************
+ * File events
+ *****************************************************************************/
+static void file_ReadCb(struct ev_loop *loop, struct ev_io *w, int revents)
+{
+    ev_io_stop(loop, w);
+    if ( b_file_fast )
+        ev_idle_start(loop, &idle_watcher);
+    else
+        file_Run();
+}
+
+static void file_IdleCb(struct ev_loop *loop, struct ev_idle *w, int revents)
+{
+    file_Run();
+}
+
+static void file_PaceCb(struct ev_loop *loop, struct ev_timer *w, int revents)
+{
+    file_Run();
+}
+
+/*****************************************************************************
+ * file_Run: releases the chunks which are due; in fast mode, the clock is
+ * moved forward to the date of each chunk instead of waiting for it
+ *****************************************************************************/
+static void file_Run( void )
+{
+    for ( ; ; )
+    {
+        if ( !b_chunk_ready && !file_ReadChunk() )
+        {
+            ev_idle_stop(event_loop, &idle_watcher);
+            if ( b_eof )
+                file_End();
+            else
+                /* The pipe is empty */
+                ev_io_start(event_loop, &file_watcher);
+            return;
+        }
+
+        i_wallclock = mdate();
+        if ( b_file_fast )
+            i_skipped += mdate_Forward( i_chunk_date );
+        else if ( i_chunk_date > i_wallclock )
+        {
+            ev_timer_set(&pace_watcher,
+                         (i_chunk_date - i_wallclock) / 1000000., 0.);
+            ev_timer_start(event_loop, &pace_watcher);
+            return;
+        }
+        else if ( i_chunk_date + FILE_MAX_LATE < i_wallclock )
+        {
+            msg_Warn( NULL, "file input is late, resetting the clock" );
+            i_base_date += i_wallclock - i_chunk_date;
+            i_chunk_date = i_wallclock;
+        }
+
+        file_SendChunk();
+
+        /* Let the outputs run between two chunks */
+        if ( b_file_fast )
+            return;
+        if ( b_chunk_undated )
+        {
+            /* Nothing to pace on, come back from the event loop */
+            ev_timer_stop(event_loop, &pace_watcher);
+            ev_timer_set(&pace_watcher, 0., 0.);
+            ev_timer_start(event_loop, &pace_watcher);
+            return;
+        }
+    }
+}
+
+/*****************************************************************************
+ * file_ReadChunk: reads packets up to the next PCR of the reference PID,
+ * returns false if the input is exhausted for now
+ *****************************************************************************/
+static bool file_ReadChunk( void )
+{
+    const uint8_t *p_packet;
+
+    b_chunk_undated = false;
+    for ( ; ; )
+    {
+        if ( (p_packet = file_NextPacket()) == NULL )
+        {
+            /* Release the remaining packets at end of file */
+            if ( !b_eof || p_chunk == NULL )
+                return false;
+            i_chunk_date = i_last_date;
+            break;
+        }
+
+        block_t *p_block = block_New();
+        memcpy( p_block->p_ts, p_packet, TS_SIZE );
+        *pp_chunk_current = p_block;
+        pp_chunk_current = &p_block->p_next;
+        i_chunk_packets++;
+
+        if ( file_HandlePCR( p_packet ) )
+            break;
+
+        if ( i_chunk_packets >= FILE_MAX_CHUNK )
+        {
+            if ( !b_pcr && !b_file_fast )
+                msg_Warn( NULL, "no PCR found, reading as fast as possible" );
+            /* In real time, undated chunks are released now */
+            i_chunk_date = b_file_fast ? i_last_date : mdate();
+            b_chunk_undated = true;
+            break;
+        }
+    }
+
+    b_chunk_ready = true;
+    return true;
+}
+
+/*****************************************************************************
+ * file_NextPacket: returns the next TS packet, or NULL
+ *****************************************************************************/
+static const uint8_t *file_NextPacket( void )
+{
+    for ( ; ; )
+    {
+        const uint8_t *p_data = p_map != NULL ? p_map : p_buffer;
+        ssize_t i_read;
+
+        while ( i_pos + TS_SIZE <= i_size )
+        {
+            const uint8_t *p_packet = p_data + i_pos;
+            unsigned int i_new_size = i_packet_size;
+            ssize_t i_sync;
+
+            if ( ts_validate( p_packet ) )
+            {
+                i_pos += i_packet_size;
+                return p_packet;
+            }
+
+            /* Realign, and detect 192 and 204-byte packets */
+            if ( b_ts_sync )
+                msg_Warn( NULL, "lost TS sync in %s", psz_file_src );
+            b_ts_sync = false;
+
+            i_sync = tssync_Find( p_packet, i_size - i_pos, &i_new_size );
+            if ( i_sync < 0 )
+            {
+                i_pos = i_size - (TS_SIZE - 1);
+                break;
+            }
+            if ( i_new_size != i_packet_size )
+                msg_Info( NULL, "detected %u-byte TS packets", i_new_size );
+            i_packet_size = i_new_size;
+            i_pos += i_sync;
+            b_ts_sync = true;
+        }
+
+        if ( p_map != NULL )
+        {
+            if ( !b_file_loop || !(i_nb_packets + i_chunk_packets) )
+            {
+                b_eof = true;
+                return NULL;
+            }
+            msg_Dbg( NULL, "looping %s", psz_file_src );
+            i_pos = 0;
+            continue;
+        }
+
+        if ( b_eof )
+            return NULL;
+
+        /* Refill the buffer, keeping the incomplete packet; the parity or
+         * timestamp of the last packet may be missing too */
+        if ( i_pos < i_size )
+        {
+            memmove( p_buffer, p_buffer + i_pos, i_size - i_pos );
+            i_size -= i_pos;
+            i_pos = 0;
+        }
+        else
+        {
+            i_pos -= i_size;
+            i_size = 0;
+        }
+
+        i_read = read( i_handle, p_buffer + i_size,
+                       FILE_BUFFER_SIZE - i_size );
+        if ( i_read < 0 )
+        {
+            if ( errno != EAGAIN && errno != EINTR )
+            {
+                msg_Err( NULL, "couldn't read from %s (%s)", psz_file_src,
+                         strerror(errno) );
+                b_eof = true;
+            }
+            return NULL;
+        }
+        if ( i_read == 0 )
+        {
+            b_eof = true;
+            return NULL;
+        }
+        i_size += i_read;
+    }
+}
+
+/*****************************************************************************
+ * file_HandlePCR: returns true and sets the date of the chunk if the packet
+ * carries a PCR of the reference PID (the first one seen)
+ *****************************************************************************/
+static bool file_HandlePCR( const uint8_t *p_ts )
+{
+    uint16_t i_pid = ts_get_pid( p_ts );
+    uint64_t i_pcr;
+
+    if ( !ts_has_adaptation( p_ts ) || !ts_get_adaptation( p_ts )
+          || !tsaf_has_pcr( p_ts ) )
+        return false;
+
+    if ( i_pcr_pid == PADDING_PID )
+    {
+        i_pcr_pid = i_pid;
+        msg_Dbg( NULL, "pacing from the PCR of PID %"PRIu16, i_pid );
+    }
+    else if ( i_pid != i_pcr_pid )
+        return false;
+
+    i_pcr = tsaf_get_pcr( p_ts ) * 300 + tsaf_get_pcrext( p_ts );
+
+    if ( !b_pcr )
+    {
+        i_pcr_ticks = i_base_ticks = 0;
+        i_base_date = i_last_date;
+        b_pcr = true;
+    }
+    else
+    {
+        uint64_t i_delta = (i_pcr + PCR_WRAP - i_last_pcr) % PCR_WRAP;
+
+        if ( i_delta > FILE_MAX_PCR_GAP )
+        {
+            /* Also happens when looping */
+            msg_Dbg( NULL, "PCR discontinuity on PID %"PRIu16, i_pid );
+            i_base_ticks = i_pcr_ticks;
+            i_base_date = i_last_date;
+        }
+        else
+            i_pcr_ticks += i_delta;
+    }
+
+    i_last_pcr = i_pcr;
+    i_chunk_date = i_base_date + (i_pcr_ticks - i_base_ticks) / 27;
+    return true;
+}
+
+/*****************************************************************************
+ * file_SendChunk
+ *****************************************************************************/
+static void file_SendChunk( void )
+{
+    block_t *p_ts = p_chunk;
+
+    i_nb_packets += i_chunk_packets;
+    i_last_date = i_chunk_date;
+    p_chunk = NULL;
+    pp_chunk_current = &p_chunk;
+    i_chunk_packets = 0;
+    b_chunk_ready = false;
+
+    if ( !b_sync )
+    {
+        msg_Info( NULL, "frontend has acquired lock" );
+        switch (i_print_type) {
+        case PRINT_XML:
+            fprintf(print_fh, "<STATUS type=\"lock\" status=\"1\"/>\n");
+            break;
+        case PRINT_TEXT:
+            fprintf(print_fh, "lock status: 1\n");
+            break;
+        default:
+            break;
+        }
+
+        b_sync = true;
+    }
+
+    demux_Run( p_ts );
+}
+
+/*****************************************************************************
+ * file_End: reports the throughput at end of file
+ *****************************************************************************/
+static void file_End( void )
+{
+    mtime_t i_duration = mdate() - i_start - i_skipped;
+
+    if ( i_duration <= 0 )
+        i_duration = 1;
+    msg_Info( NULL, "end of %s, %"PRIu64" packets in %.3f s (%.1f Mbit/s)",
+              psz_file_src, i_nb_packets, i_duration / 1000000.,
+              (double)i_nb_packets * TS_SIZE * 8 / i_duration );
+
+    switch (i_print_type) {
+    case PRINT_XML:
+        fprintf(print_fh, "<STATUS type=\"file\" packets=\"%"PRIu64"\" duration=\"%"PRId64"\"/>\n",
+                i_nb_packets, i_duration);
+        fprintf(print_fh, "<STATUS type=\"lock\" status=\"0\"/>\n");
+        break;
+    case PRINT_TEXT:
+        fprintf(print_fh, "file: %"PRIu64" packets in %"PRId64" us\n",
+                i_nb_packets, i_duration);
+        fprintf(print_fh, "lock status: 0\n" );
+        break;
+    default:
+        break;
+    }
+
+    b_sync = false;
+}
+
+/*****************************************************************************
+ * file_SetFilter
+ *****************************************************************************/
+int file_SetFilter( uint16_t i_pid )
+{
+    return -1;
+}
+
+/*****************************************************************************
+ * file_UnsetFilter: normally never called
+ *****************************************************************************/
+void file_UnsetFilter( int i_fd, uint16_t i_pid )
+{
+}
+
+/*****************************************************************************
+ * file_Reset:
+ *****************************************************************************/
+void file_Reset( void )
+{
+}
@@ -0,0 +1,547 @@
+/*****************************************************************************
+ * http.c: unicast HTTP output server
+ *****************************************************************************
+ * Copyright (C) 2026 VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+#define _GNU_SOURCE /* accept4 */
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <ev.h>
+
+#include <bitstream/common.h>
+#include <bitstream/mpeg/ts.h>
+#include <bitstream/mpeg/psi.h>
+
+#include "dvblast.h"
+
+/*****************************************************************************
+ * Local declarations
+ *****************************************************************************/
+#define HTTP_RING_PACKETS 16384 /* TS packets per stream, about 3 MB */
+#define HTTP_RING_SIZE (HTTP_RING_PACKETS * TS_SIZE)
+#define HTTP_MAX_REQUEST 2048
+#define HTTP_MAX_CLIENTS 1024
+#define HTTP_SNDBUF (1024 * 1024)
+#define HTTP_REQUEST_TIMEOUT 5000000 /* 5 s to send the request */
+#define HTTP_SWEEP_PERIOD 1. /* s */
+
+typedef struct http_client_t
+{
+    int i_fd;
+    struct ev_io watcher;
+    http_stream_t *p_stream; /* NULL until the request is complete */
+    struct http_client_t *p_next;
+    mtime_t i_accept_date;
+
+    char psz_request[HTTP_MAX_REQUEST];
+    size_t i_request;
+    const char *psz_header; /* response header left to send */
+    size_t i_header;
+
+    uint64_t i_read; /* read cursor in the ring of the stream */
+    bool b_blocked; /* waiting for the socket to be writable */
+} http_client_t;
+
+struct http_stream_t
+{
+    char *psz_name; /* request path */
+    uint8_t *p_ring;
+    uint64_t i_write; /* bytes written since the beginning, whole packets */
+    uint64_t i_pat; /* position of the last PAT, UINT64_MAX if none */
+    http_client_t *p_clients;
+    int i_nb_clients;
+};
+
+static int i_listen_fd = -1;
+static struct ev_io listen_watcher;
+static struct ev_timer sweep_watcher;
+static http_stream_t **pp_streams = NULL;
+static int i_nb_streams = 0;
+static http_client_t *p_pending = NULL; /* clients without a stream yet */
+static int i_nb_clients = 0;
+
+static const char psz_ok[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: video/MP2T\r\n"
+    "Cache-Control: no-cache\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+static const char psz_not_found[] =
+    "HTTP/1.1 404 Not Found\r\n"
+    "Content-Length: 0\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+static const char psz_bad_request[] =
+    "HTTP/1.1 400 Bad Request\r\n"
+    "Content-Length: 0\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+
+/*****************************************************************************
+ * Local prototypes
+ *****************************************************************************/
+static void http_Accept( struct ev_loop *loop, struct ev_io *w, int revents );
+static void http_ClientRead( struct ev_loop *loop, struct ev_io *w,
+                             int revents );
+static void http_ClientWrite( struct ev_loop *loop, struct ev_io *w,
+                              int revents );
+static void http_Sweep( struct ev_loop *loop, struct ev_timer *w,
+                        int revents );
+
+/*****************************************************************************
+ * http_Open: starts listening on psz_address, host:port
+ *****************************************************************************/
+void http_Open( const char *psz_address )
+{
+    struct addrinfo *p_ai;
+    char *psz_string = strdup( psz_address );
+    int i = 1;
+
+    p_ai = ParseNodeService( psz_string, NULL, 0 );
+    free( psz_string );
+    if ( p_ai == NULL )
+    {
+        msg_Err( NULL, "invalid HTTP listen address %s", psz_address );
+        exit(EXIT_FAILURE);
+    }
+
+    if ( (i_listen_fd = socket( p_ai->ai_family,
+                                SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                                0 )) < 0 )
+    {
+        msg_Err( NULL, "couldn't create HTTP socket (%s)", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+
+    setsockopt( i_listen_fd, SOL_SOCKET, SO_REUSEADDR, &i, sizeof(i) );
+    if ( bind( i_listen_fd, p_ai->ai_addr, p_ai->ai_addrlen ) < 0
+          || listen( i_listen_fd, SOMAXCONN ) < 0 )
+    {
+        msg_Err( NULL, "couldn't listen on %s (%s)", psz_address,
+                 strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+    freeaddrinfo( p_ai );
+
+    ev_io_init( &listen_watcher, http_Accept, i_listen_fd, EV_READ );
+    ev_io_start( event_loop, &listen_watcher );
+    ev_timer_init( &sweep_watcher, http_Sweep, HTTP_SWEEP_PERIOD,
+                   HTTP_SWEEP_PERIOD );
+    ev_timer_start( event_loop, &sweep_watcher );
+    msg_Dbg( NULL, "HTTP server listening on %s", psz_address );
+}
+
+/*****************************************************************************
+ * http_ClientClose
+ *****************************************************************************/
+static void http_ClientClose( http_client_t *p_client )
+{
+    http_client_t **pp_client = p_client->p_stream != NULL ?
+        &p_client->p_stream->p_clients : &p_pending;
+
+    while ( *pp_client != p_client )
+        pp_client = &(*pp_client)->p_next;
+    *pp_client = p_client->p_next;
+    if ( p_client->p_stream != NULL )
+        p_client->p_stream->i_nb_clients--;
+    i_nb_clients--;
+
+    ev_io_stop( event_loop, &p_client->watcher );
+    close( p_client->i_fd );
+    free( p_client );
+}
+
+/*****************************************************************************
+ * http_ClientSend: sends the response header and the stream data up to the
+ * write position, in one call; returns false if the client was closed
+ *****************************************************************************/
+static bool http_ClientSend( http_client_t *p_client )
+{
+    http_stream_t *p_stream = p_client->p_stream;
+    struct iovec p_iov[3];
+    struct msghdr msg;
+    int i_iov = 0;
+    ssize_t i_ret;
+
+    if ( p_client->i_header )
+    {
+        p_iov[i_iov].iov_base = (void *)p_client->psz_header;
+        p_iov[i_iov].iov_len = p_client->i_header;
+        i_iov++;
+    }
+
+    if ( p_stream != NULL && p_client->i_read < p_stream->i_write )
+    {
+        size_t i_offset = p_client->i_read % HTTP_RING_SIZE;
+        size_t i_len = p_stream->i_write - p_client->i_read;
+
+        p_iov[i_iov].iov_base = p_stream->p_ring + i_offset;
+        p_iov[i_iov].iov_len = i_len;
+        if ( i_offset + i_len > HTTP_RING_SIZE )
+        {
+            /* The data wraps around the end of the ring */
+            p_iov[i_iov].iov_len = HTTP_RING_SIZE - i_offset;
+            i_iov++;
+            p_iov[i_iov].iov_base = p_stream->p_ring;
+            p_iov[i_iov].iov_len = i_len - (HTTP_RING_SIZE - i_offset);
+        }
+        i_iov++;
+    }
+
+    if ( !i_iov )
+        return true;
+
+    memset( &msg, 0, sizeof(msg) );
+    msg.msg_iov = p_iov;
+    msg.msg_iovlen = i_iov;
+    i_ret = sendmsg( p_client->i_fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT );
+    if ( i_ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK
+                        || errno == EINTR) )
+        i_ret = 0;
+    if ( i_ret < 0 )
+    {
+        msg_Dbg( NULL, "HTTP client disconnected (%s)", strerror(errno) );
+        http_ClientClose( p_client );
+        return false;
+    }
+
+    if ( (size_t)i_ret >= p_client->i_header )
+    {
+        i_ret -= p_client->i_header;
+        p_client->i_header = 0;
+        p_client->i_read += i_ret;
+    }
+    else
+    {
+        p_client->psz_header += i_ret;
+        p_client->i_header -= i_ret;
+    }
+
+    if ( p_client->i_header == 0 && p_stream == NULL )
+    {
+        /* Error response sent */
+        http_ClientClose( p_client );
+        return false;
+    }
+
+    /* Wait for the socket if it didn't take everything */
+    p_client->b_blocked = p_client->i_header
+        || (p_stream != NULL && p_client->i_read < p_stream->i_write);
+    ev_io_stop( event_loop, &p_client->watcher );
+    if ( p_client->b_blocked )
+    {
+        ev_io_init( &p_client->watcher, http_ClientWrite, p_client->i_fd,
+                    EV_WRITE );
+        ev_io_start( event_loop, &p_client->watcher );
+    }
+    return true;
+}
+
+/*****************************************************************************
+ * http_Accept: listening socket callback
+ *****************************************************************************/
+static void http_Accept( struct ev_loop *loop, struct ev_io *w, int revents )
+{
+    http_client_t *p_client;
+    int i_fd, i_size = HTTP_SNDBUF, i = 1;
+
+    while ( (i_fd = accept4( i_listen_fd, NULL, NULL,
+                             SOCK_NONBLOCK | SOCK_CLOEXEC )) >= 0 )
+    {
+        if ( i_nb_clients >= HTTP_MAX_CLIENTS )
+        {
+            msg_Warn( NULL, "too many HTTP clients, rejecting" );
+            close( i_fd );
+            continue;
+        }
+
+        setsockopt( i_fd, SOL_SOCKET, SO_SNDBUF, &i_size, sizeof(i_size) );
+        setsockopt( i_fd, IPPROTO_TCP, TCP_NODELAY, &i, sizeof(i) );
+
+        p_client = calloc( 1, sizeof(http_client_t) );
+        p_client->i_fd = i_fd;
+        p_client->i_accept_date = mdate();
+        p_client->p_next = p_pending;
+        p_pending = p_client;
+        i_nb_clients++;
+
+        ev_io_init( &p_client->watcher, http_ClientRead, i_fd, EV_READ );
+        p_client->watcher.data = p_client;
+        ev_io_start( event_loop, &p_client->watcher );
+    }
+
+    if ( errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR )
+        msg_Warn( NULL, "couldn't accept HTTP client (%s)", strerror(errno) );
+}
+
+/*****************************************************************************
+ * http_ClientRequest: handles a complete request
+ *****************************************************************************/
+static void http_ClientRequest( http_client_t *p_client )
+{
+    char *psz_path = p_client->psz_request + 4, *psz_end;
+    int i;
+
+    ev_io_stop( event_loop, &p_client->watcher );
+
+    if ( strncmp( p_client->psz_request, "GET ", 4 )
+          || (psz_end = strchr( psz_path, ' ' )) == NULL )
+    {
+        p_client->psz_header = psz_bad_request;
+        p_client->i_header = sizeof(psz_bad_request) - 1;
+        http_ClientSend( p_client );
+        return;
+    }
+    *psz_end = '\0';
+    psz_path[strcspn( psz_path, "?" )] = '\0';
+
+    for ( i = 0; i < i_nb_streams; i++ )
+        if ( !strcmp( pp_streams[i]->psz_name, psz_path ) )
+            break;
+    if ( i == i_nb_streams )
+    {
+        msg_Dbg( NULL, "HTTP client requested unknown %s", psz_path );
+        p_client->psz_header = psz_not_found;
+        p_client->i_header = sizeof(psz_not_found) - 1;
+        http_ClientSend( p_client );
+        return;
+    }
+
+    http_client_t **pp_client = &p_pending;
+    while ( *pp_client != p_client )
+        pp_client = &(*pp_client)->p_next;
+    *pp_client = p_client->p_next;
+
+    http_stream_t *p_stream = pp_streams[i];
+    p_client->p_stream = p_stream;
+    p_client->p_next = p_stream->p_clients;
+    p_stream->p_clients = p_client;
+    p_stream->i_nb_clients++;
+
+    /* Start at the last PAT so that the client can decode immediately */
+    p_client->i_read = p_stream->i_write;
+    if ( p_stream->i_pat != UINT64_MAX
+          && p_stream->i_write - p_stream->i_pat < HTTP_RING_SIZE / 2 )
+        p_client->i_read = p_stream->i_pat;
+
+    p_client->psz_header = psz_ok;
+    p_client->i_header = sizeof(psz_ok) - 1;
+    msg_Dbg( NULL, "HTTP client connected to %s (%d clients)", psz_path,
+             p_stream->i_nb_clients );
+    http_ClientSend( p_client );
+}
+
+/*****************************************************************************
+ * http_ClientRead: reads the request
+ *****************************************************************************/
+static void http_ClientRead( struct ev_loop *loop, struct ev_io *w,
+                             int revents )
+{
+    http_client_t *p_client = w->data;
+    ssize_t i_ret;
+
+    i_ret = recv( p_client->i_fd, p_client->psz_request + p_client->i_request,
+                  HTTP_MAX_REQUEST - 1 - p_client->i_request, 0 );
+    if ( i_ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK
+                        || errno == EINTR) )
+        return;
+    if ( i_ret <= 0 )
+    {
+        http_ClientClose( p_client );
+        return;
+    }
+
+    p_client->i_request += i_ret;
+    p_client->psz_request[p_client->i_request] = '\0';
+    if ( strstr( p_client->psz_request, "\r\n\r\n" ) != NULL
+          || strstr( p_client->psz_request, "\n\n" ) != NULL )
+        http_ClientRequest( p_client );
+    else if ( p_client->i_request == HTTP_MAX_REQUEST - 1 )
+    {
+        ev_io_stop( event_loop, &p_client->watcher );
+        p_client->psz_header = psz_bad_request;
+        p_client->i_header = sizeof(psz_bad_request) - 1;
+        http_ClientSend( p_client );
+    }
+}
+
+/*****************************************************************************
+ * http_ClientWrite: the socket of a blocked client is writable again
+ *****************************************************************************/
+static void http_ClientWrite( struct ev_loop *loop, struct ev_io *w,
+                              int revents )
+{
+    http_ClientSend( w->data );
+}
+
+/*****************************************************************************
+ * http_Sweep: closes the clients which didn't send their request in time,
+ * so that idle connections can't use up HTTP_MAX_CLIENTS
+ *****************************************************************************/
+static void http_Sweep( struct ev_loop *loop, struct ev_timer *w,
+                        int revents )
+{
+    mtime_t i_now = mdate();
+    http_client_t *p_client = p_pending;
+
+    while ( p_client != NULL )
+    {
+        http_client_t *p_next = p_client->p_next;
+
+        if ( p_client->i_accept_date + HTTP_REQUEST_TIMEOUT < i_now )
+        {
+            msg_Dbg( NULL, "HTTP client timed out" );
+            http_ClientClose( p_client );
+        }
+        p_client = p_next;
+    }
+}
+
+/*****************************************************************************
+ * http_StreamOpen: creates the ring of an output, served at psz_path
+ *****************************************************************************/
+http_stream_t *http_StreamOpen( const output_config_t *p_config )
+{
+    http_stream_t *p_stream;
+
+    if ( i_listen_fd < 0 )
+    {
+        msg_Err( NULL, "%s: no HTTP server, use --http-listen",
+                 p_config->psz_displayname );
+        return NULL;
+    }
+
+    p_stream = calloc( 1, sizeof(http_stream_t) );
+    p_stream->psz_name = strdup( p_config->psz_path );
+    p_stream->p_ring = malloc( HTTP_RING_SIZE );
+    p_stream->i_pat = UINT64_MAX;
+
+    pp_streams = realloc( pp_streams,
+                          (i_nb_streams + 1) * sizeof(http_stream_t *) );
+    pp_streams[i_nb_streams++] = p_stream;
+    return p_stream;
+}
+
+/*****************************************************************************
+ * http_StreamWrite: appends the TS packets of an iovec, made of whole
+ * packets, to the ring and sends them to the clients which are not blocked
+ *****************************************************************************/
+void http_StreamWrite( http_stream_t *p_stream, const struct iovec *p_iov,
+                       int i_iov )
+{
+    http_client_t *p_client, *p_next;
+    uint64_t i_start = p_stream->i_write;
+    int i;
+
+    for ( i = 0; i < i_iov; i++ )
+    {
+        const uint8_t *p_data = p_iov[i].iov_base;
+        size_t i_len = p_iov[i].iov_len;
+
+        if ( !i_len )
+            continue;
+        if ( p_stream->i_write % TS_SIZE == 0
+              && ts_get_pid( p_data ) == PAT_PID )
+            p_stream->i_pat = p_stream->i_write;
+
+        while ( i_len )
+        {
+            size_t i_offset = p_stream->i_write % HTTP_RING_SIZE;
+            size_t i_copy = HTTP_RING_SIZE - i_offset;
+            if ( i_copy > i_len )
+                i_copy = i_len;
+
+            memcpy( p_stream->p_ring + i_offset, p_data, i_copy );
+            p_stream->i_write += i_copy;
+            p_data += i_copy;
+            i_len -= i_copy;
+        }
+    }
+
+    if ( p_stream->i_write == i_start )
+        return;
+
+    for ( p_client = p_stream->p_clients; p_client != NULL;
+          p_client = p_next )
+    {
+        p_next = p_client->p_next;
+
+        if ( p_stream->i_write - p_client->i_read > HTTP_RING_SIZE )
+        {
+            /* Its data was overwritten */
+            msg_Warn( NULL, "HTTP client of %s is too slow, disconnecting",
+                      p_stream->psz_name );
+            http_ClientClose( p_client );
+            continue;
+        }
+        if ( !p_client->b_blocked )
+            http_ClientSend( p_client );
+    }
+}
+
+/*****************************************************************************
+ * http_StreamClose: disconnects the clients of an output and frees it
+ *****************************************************************************/
+void http_StreamClose( http_stream_t *p_stream )
+{
+    int i;
+
+    while ( p_stream->p_clients != NULL )
+        http_ClientClose( p_stream->p_clients );
+
+    for ( i = 0; i < i_nb_streams; i++ )
+        if ( pp_streams[i] == p_stream )
+            break;
+    if ( i < i_nb_streams )
+        pp_streams[i] = pp_streams[--i_nb_streams];
+
+    free( p_stream->psz_name );
+    free( p_stream->p_ring );
+    free( p_stream );
+}
+
+/*****************************************************************************
+ * http_Close: closes the listening socket and the pending clients
+ *****************************************************************************/
+void http_Close( void )
+{
+    if ( i_listen_fd < 0 )
+        return;
+
+    while ( p_pending != NULL )
+        http_ClientClose( p_pending );
+    ev_timer_stop( event_loop, &sweep_watcher );
+    ev_io_stop( event_loop, &listen_watcher );
+    close( i_listen_fd );
+    i_listen_fd = -1;
+    free( pp_streams );
+    pp_streams = NULL;
+    i_nb_streams = 0;
+}
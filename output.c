@@ -21,8 +21,10 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
  *****************************************************************************/
 
+#define _GNU_SOURCE /* sendmmsg() */
 #include <stdlib.h>
 #include <unistd.h>
+#include <limits.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
@@ -33,10 +35,19 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/uio.h>
+#include <netinet/udp.h>
 #include <errno.h>
+#include <pthread.h>
+#include <time.h>
 #include <ev.h>
 
 #include "dvblast.h"
+#include "en50221.h"
+#include "comm.h"
+
+#ifdef HAVE_SO_TXTIME
+#include <linux/net_tstamp.h>
+#endif
 
 #include <bitstream/mpeg/ts.h>
 #include <bitstream/ietf/rtp.h>
@@ -45,18 +56,180 @@
  * Local declarations
  *****************************************************************************/
 #define MAX_PACKETS 100
+#define PACKET_POOL_BLOCKS 7 /* packets of larger MTUs are malloc'ed */
+
+#define OUTPUT_BATCH_MAX 64 /* datagrams per sendmmsg() */
+#define GSO_MAX_SIZE 65000 /* bytes per UDP_SEGMENT message */
+#define UDP_MAX_SEGMENTS 64 /* segments per UDP_SEGMENT message */
+#define PCR_WRAP ((UINT64_C(1) << 33) * 300)
+
+#define RETX_HISTORY_SIZE 8192 /* datagrams, power of 2 */
+#define RETX_HOLDOFF 10000 /* 10 ms between retransmissions of a datagram */
+#define RETX_PAYLOAD_TYPE 97 /* dynamic, for the RTX stream */
+#define RTCP_PERIOD 5. /* seconds between sender reports */
+#define RTCP_MAX_SIZE 1500
+#define RTCP_PT_SR 200
+#define RTCP_PT_RR 201
+#define RTCP_PT_SDES 202
+#define RTCP_PT_RTPFB 205
+#define NTP_EPOCH_OFFSET UINT64_C(2208988800) /* 1900 to 1970, seconds */
+
+#ifdef HAVE_UDP_GSO
+#ifndef SOL_UDP
+#   define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#   define UDP_SEGMENT 103
+#endif
+#endif
+
+#ifndef IPV6_HDRINCL
+#   define IPV6_HDRINCL 36 /* Linux 4.5 */
+#endif
+
+#ifdef HAVE_SO_TXTIME
+#ifndef SO_TXTIME
+#   define SO_TXTIME 61
+#   define SCM_TXTIME SO_TXTIME
+#endif
+#ifndef CLOCK_TAI
+#   define CLOCK_TAI 11
+#endif
+#endif
 
 static struct ev_timer output_watcher;
+static struct ev_timer rtcp_watcher;
+static char psz_rtcp_cname[256];
 static mtime_t i_next_send = INT64_MAX;
 
+#ifndef HAVE_SENDMMSG
+struct mmsghdr
+{
+    struct msghdr msg_hdr;
+    unsigned int msg_len;
+};
+#endif
+
+/* Send buffers, one set per sending thread */
+static __thread struct mmsghdr p_send_msgs[OUTPUT_BATCH_MAX];
+static __thread uint8_t pp_rtp_hdrs[OUTPUT_BATCH_MAX][RTP_HEADER_SIZE];
+static __thread int pi_send_segs[OUTPUT_BATCH_MAX]; /* datagrams per message */
+static __thread struct iovec *p_send_iov = NULL;
+static __thread int i_send_iov_size = 0;
+static __thread uint8_t (*p_remap_hdrs)[TS_HEADER_SIZE] = NULL;
+static __thread uint8_t (*p_copy_ts)[TS_SIZE] = NULL; /* restamped packets */
+static __thread int i_remap_size = 0, i_copy_size = 0;
+static __thread uint64_t pi_send_txtimes[OUTPUT_BATCH_MAX]; /* ns */
+static __thread struct udpraw6pkt p_raw6_hdrs[OUTPUT_BATCH_MAX];
+static __thread union
+{
+    /* UDP_SEGMENT then SCM_TXTIME */
+    uint8_t p_buf[CMSG_SPACE(sizeof(uint16_t)) + CMSG_SPACE(sizeof(uint64_t))];
+    struct cmsghdr align;
+} p_send_cmsgs[OUTPUT_BATCH_MAX];
+
+/* Outputs with packets, ordered by the date their first packet is due */
+typedef struct output_heap_t
+{
+    output_t **pp_outputs;
+    int i_nb_outputs, i_max_outputs;
+} output_heap_t;
+
+static output_heap_t output_heap; /* main thread */
+
+/* Sender threads, see --output-threads */
+#define WORKER_RING_SIZE 65536 /* blocks in flight, power of 2 */
+
+typedef struct worker_entry_t
+{
+    output_t *p_output;
+    block_t *p_block;
+} worker_entry_t;
+
+struct output_worker_t
+{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    struct ev_loop *p_loop;
+    struct ev_timer send_watcher;
+    struct ev_async wake_watcher;
+    bool b_exit;
+
+    /* main thread to worker: blocks to send */
+    worker_entry_t *p_entries;
+    unsigned int i_entries_read, i_entries_write;
+    bool b_pending, b_overrun; /* main thread only */
+
+    /* worker to main thread: blocks to release */
+    block_t **pp_returns;
+    unsigned int i_returns_read, i_returns_write;
+    block_t **pp_overflow; /* worker only, when pp_returns is full */
+    int i_nb_overflow, i_max_overflow;
+
+    output_t **pp_outputs;
+    int i_nb_outputs;
+    output_heap_t heap;
+};
+
+static output_worker_t *p_workers = NULL;
+static int i_outputs_locked = 0; /* nesting depth of outputs_Lock() */
+static int i_next_worker = 0;
+static __thread output_worker_t *p_current_worker = NULL;
+
+static void worker_Push( output_worker_t *p_worker, output_t *p_output,
+                         block_t *p_block );
+static void output_SetRTCP( output_t *p_output, bool b_rtcp );
+static void output_SetRetx( output_t *p_output, mtime_t i_retx );
+
+/* RTP retransmission, see /retx */
+struct output_retx_t
+{
+    packet_t *pp_history[RETX_HISTORY_SIZE]; /* sent, by sequence number */
+    uint16_t i_first; /* sequence number of the oldest packet */
+    int i_count;
+    uint16_t i_seqnum; /* of the RTX stream */
+    uint8_t pi_ssrc[4]; /* of the RTX stream */
+};
+
+/* RTCP companion socket, see /rtcp */
+struct output_rtcp_t
+{
+    output_t *p_output;
+    int i_handle;
+    struct ev_io watcher;
+    struct sockaddr_storage peer_addr; /* destination port plus one */
+
+    uint64_t i_packets, i_octets; /* sent, by the sender thread */
+    uint64_t i_retransmitted;
+
+    /* last receiver report */
+    uint64_t i_reports;
+    mtime_t i_report_date; /* -1 if none */
+    uint8_t i_fraction_lost; /* in 1/256 */
+    int32_t i_cumulative_lost;
+    mtime_t i_jitter;
+    mtime_t i_rtt; /* -1 if unknown */
+};
+
+/* Statistics exported with CMD_GET_OUTPUT_STATUS, updated by all threads */
+static uint64_t i_send_syscalls = 0, i_send_datagrams = 0;
+static unsigned int i_send_max_batch = 0;
+static uint64_t pi_send_histogram[OUTPUT_HISTOGRAM_SIZE];
+
 struct packet_t
 {
     struct packet_t *p_next;
     mtime_t i_dts;
+    mtime_t i_sent; /* PCR restamping reference */
+    mtime_t i_send_date; /* RTP timestamp */
+    mtime_t i_retx_date; /* last retransmission */
+    uint16_t i_seqnum;
     int i_depth;
     block_t *pp_blocks[];
 };
 
+static pool_t *p_packet_pool = NULL;
+
 static uint8_t p_pad_ts[TS_SIZE] = {
     0x47, 0x1f, 0xff, 0x10, 0xff, 0xff, 0xff, 0xff,
     0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
@@ -120,6 +293,118 @@ static void RawFillHeaders(struct udprawpkt *dgram,
     //iph->check = csum((unsigned short *)iph, sizeof(struct iphdr));
 }
 
+/*****************************************************************************
+ * output_Checksum : add an iovec to a ones' complement sum (RFC 1071); the
+ * sum is kept in host byte order, which gives the checksum in network byte
+ * order once stored as is
+ *****************************************************************************/
+static uint64_t output_Checksum( const struct iovec *p_iov, int i_iov,
+                                 uint64_t i_sum )
+{
+    bool b_odd = false;
+    int i;
+
+    for ( i = 0; i < i_iov; i++ )
+    {
+        const uint8_t *p_data = p_iov[i].iov_base;
+        size_t i_len = p_iov[i].iov_len;
+        uint64_t i_part = 0;
+
+        /* Two independent 32-bit additions per iteration */
+        for ( ; i_len >= 8; p_data += 8, i_len -= 8 )
+        {
+            uint32_t i_word1, i_word2;
+            memcpy( &i_word1, p_data, 4 );
+            memcpy( &i_word2, p_data + 4, 4 );
+            i_part += i_word1;
+            i_part += i_word2;
+        }
+        for ( ; i_len >= 2; p_data += 2, i_len -= 2 )
+        {
+            uint16_t i_word;
+            memcpy( &i_word, p_data, 2 );
+            i_part += i_word;
+        }
+        if ( i_len )
+        {
+            uint16_t i_word = 0;
+            memcpy( &i_word, p_data, 1 );
+            i_part += i_word;
+        }
+
+        while ( i_part >> 16 )
+            i_part = (i_part & 0xffff) + (i_part >> 16);
+        /* A part starting at an odd offset has its bytes swapped */
+        if ( b_odd )
+            i_part = ((i_part & 0xff) << 8) | (i_part >> 8);
+        i_sum += i_part;
+        if ( p_iov[i].iov_len & 1 )
+            b_odd = !b_odd;
+    }
+
+    return i_sum;
+}
+
+/*****************************************************************************
+ * Raw6FillHeaders : fill the ipv6/udp header template of a RAW socket, and
+ * sum its constant part for the UDP checksum
+ *****************************************************************************/
+static void Raw6FillHeaders( output_t *p_output, const char *psz_src,
+                             uint16_t i_srcport, uint8_t i_ttl, uint8_t i_tos )
+{
+    struct udpraw6pkt *p_hdr = &p_output->raw6_pkt_header;
+    struct sockaddr_in6 *p_connect_addr =
+        (struct sockaddr_in6 *)&p_output->config.connect_addr;
+    struct iovec iov[2];
+    uint16_t i_proto = htons( IPPROTO_UDP );
+
+    memset( p_hdr, 0, sizeof(struct udpraw6pkt) );
+    p_hdr->ip6h.ip6_flow = htonl( (6 << 28) | (i_tos << 20) );
+    p_hdr->ip6h.ip6_nxt = IPPROTO_UDP;
+    p_hdr->ip6h.ip6_hlim = i_ttl;
+    inet_pton( AF_INET6, psz_src, &p_hdr->ip6h.ip6_src );
+    p_hdr->ip6h.ip6_dst = p_connect_addr->sin6_addr;
+    p_hdr->udph.source = htons( i_srcport );
+    p_hdr->udph.dest = p_connect_addr->sin6_port;
+
+    /* Pseudo-header addresses and next header, and the ports */
+    iov[0].iov_base = &p_hdr->ip6h.ip6_src;
+    iov[0].iov_len = 2 * sizeof(struct in6_addr);
+    iov[1].iov_base = &p_hdr->udph;
+    iov[1].iov_len = 2 * sizeof(uint16_t);
+    p_output->i_raw6_csum = output_Checksum( iov, 2, i_proto );
+}
+
+/*****************************************************************************
+ * output_Raw6Header : finish the ipv6/udp header of a datagram, whose
+ * payload is in p_iov
+ *****************************************************************************/
+static void output_Raw6Header( output_t *p_output, struct udpraw6pkt *p_hdr,
+                               const struct iovec *p_iov, int i_iov )
+{
+    uint16_t i_len = sizeof(struct udpheader);
+    uint64_t i_sum;
+    uint16_t i_csum;
+    int i;
+
+    for ( i = 0; i < i_iov; i++ )
+        i_len += p_iov[i].iov_len;
+
+    memcpy( p_hdr, &p_output->raw6_pkt_header, sizeof(struct udpraw6pkt) );
+    p_hdr->ip6h.ip6_plen = htons( i_len );
+    p_hdr->udph.len = htons( i_len );
+
+    /* The length is in the pseudo-header and in the UDP header */
+    i_sum = output_Checksum( p_iov, i_iov, p_output->i_raw6_csum
+                                            + 2 * (uint64_t)htons( i_len ) );
+    while ( i_sum >> 16 )
+        i_sum = (i_sum & 0xffff) + (i_sum >> 16);
+    i_csum = ~i_sum;
+    if ( !i_csum )
+        i_csum = 0xffff; /* 0 means no checksum, which IPv6 forbids */
+    memcpy( &p_hdr->udph.check, &i_csum, 2 );
+}
+
 /*****************************************************************************
  * output_BlockCount
  *****************************************************************************/
@@ -146,8 +431,8 @@ packet_t *output_PacketNew( output_t *p_output )
     }
     else
     {
-        p_packet = malloc(sizeof(packet_t) +
-                          output_BlockCount(p_output) * sizeof(block_t *) );
+        p_packet = pool_Alloc( p_packet_pool, sizeof(packet_t) +
+                               output_BlockCount(p_output) * sizeof(block_t *) );
     }
 
     p_packet->i_depth = 0;
@@ -162,7 +447,7 @@ void output_PacketDelete( output_t *p_output, packet_t *p_packet )
 {
     if (p_output->i_packet_count >= MAX_PACKETS )
     {
-        free( p_packet );
+        pool_Free( p_packet_pool, p_packet );
         return;
     }
 
@@ -180,11 +465,249 @@ void output_PacketVacuum( output_t *p_output )
     {
         packet_t *p_packet = p_output->p_packet_lifo;
         p_output->p_packet_lifo = p_packet->p_next;
-        free(p_packet);
+        pool_Free( p_packet_pool, p_packet );
         p_output->i_packet_count--;
     }
 }
 
+/*****************************************************************************
+ * output_BlockRelease : drop a reference to a sent block; reference counts
+ * belong to the main thread, sender threads hand the blocks back to it
+ *****************************************************************************/
+static void output_BlockRelease( block_t *p_block )
+{
+    output_worker_t *p_worker = p_current_worker;
+
+    if ( p_worker != NULL )
+    {
+        unsigned int i_write = p_worker->i_returns_write;
+        unsigned int i_read = __atomic_load_n( &p_worker->i_returns_read,
+                                               __ATOMIC_ACQUIRE );
+
+        if ( p_worker->i_nb_overflow || i_write - i_read == WORKER_RING_SIZE )
+        {
+            if ( p_worker->i_nb_overflow == p_worker->i_max_overflow )
+            {
+                p_worker->i_max_overflow = p_worker->i_max_overflow * 2 + 64;
+                p_worker->pp_overflow = realloc( p_worker->pp_overflow,
+                        p_worker->i_max_overflow * sizeof(block_t *) );
+            }
+            p_worker->pp_overflow[p_worker->i_nb_overflow++] = p_block;
+            return;
+        }
+
+        p_worker->pp_returns[i_write & (WORKER_RING_SIZE - 1)] = p_block;
+        __atomic_store_n( &p_worker->i_returns_write, i_write + 1,
+                          __ATOMIC_RELEASE );
+        return;
+    }
+
+    p_block->i_refcount--;
+    if ( !p_block->i_refcount )
+        block_Delete( p_block );
+}
+
+/*****************************************************************************
+ * output_CheckGSO : returns true if the output socket can send UDP_SEGMENT
+ * messages
+ *****************************************************************************/
+static bool output_CheckGSO( output_t *p_output )
+{
+#ifdef HAVE_UDP_GSO
+    int i_gso_size;
+    socklen_t i_len = sizeof(i_gso_size);
+
+    if ( p_output->config.i_config & OUTPUT_RAW )
+    {
+        msg_Warn( NULL, "UDP GSO is not available with RAW sockets (%s)",
+                  p_output->config.psz_displayname );
+        return false;
+    }
+
+    if ( getsockopt( p_output->i_handle, SOL_UDP, UDP_SEGMENT, &i_gso_size,
+                     &i_len ) < 0 )
+    {
+        msg_Warn( NULL, "UDP GSO is not supported on %s (%s)",
+                  p_output->config.psz_displayname, strerror(errno) );
+        return false;
+    }
+    return true;
+#else
+    msg_Warn( NULL, "UDP GSO is not supported on this platform" );
+    return false;
+#endif
+}
+
+/*****************************************************************************
+ * output_SetTxtime : enables SO_TXTIME on the output socket, returns false
+ * if the kernel refuses it
+ *****************************************************************************/
+static bool output_SetTxtime( output_t *p_output, bool b_tai )
+{
+#ifdef HAVE_SO_TXTIME
+    struct sock_txtime txtime;
+
+    memset( &txtime, 0, sizeof(txtime) );
+    txtime.clockid = b_tai ? CLOCK_TAI : CLOCK_MONOTONIC;
+    if ( setsockopt( p_output->i_handle, SOL_SOCKET, SO_TXTIME, &txtime,
+                     sizeof(txtime) ) < 0 )
+    {
+        msg_Warn( NULL, "SO_TXTIME is not supported on %s (%s)",
+                  p_output->config.psz_displayname, strerror(errno) );
+        return false;
+    }
+    return true;
+#else
+    msg_Warn( NULL, "SO_TXTIME is not supported on this platform" );
+    return false;
+#endif
+}
+
+/*****************************************************************************
+ * output_Due : returns the date at which a packet must be handed to the
+ * kernel; with SO_TXTIME the kernel holds it until its launch time
+ *****************************************************************************/
+static inline mtime_t output_Due( const output_t *p_output,
+                                  const packet_t *p_packet )
+{
+    return p_packet->i_dts + p_output->config.i_output_latency
+            - (p_output->b_txtime ? TXTIME_ADVANCE : 0);
+}
+
+/*****************************************************************************
+ * heap_Set : put an output at position i of the heap
+ *****************************************************************************/
+static inline void heap_Set( output_heap_t *p_heap, int i, output_t *p_output )
+{
+    p_heap->pp_outputs[i] = p_output;
+    p_output->i_heap_index = i;
+}
+
+/*****************************************************************************
+ * heap_Up : move an output towards the root until its parent is due first
+ *****************************************************************************/
+static void heap_Up( output_heap_t *p_heap, int i )
+{
+    output_t *p_output = p_heap->pp_outputs[i];
+
+    while ( i > 0 )
+    {
+        int i_parent = (i - 1) / 2;
+        if ( p_heap->pp_outputs[i_parent]->i_heap_date <= p_output->i_heap_date )
+            break;
+        heap_Set( p_heap, i, p_heap->pp_outputs[i_parent] );
+        i = i_parent;
+    }
+    heap_Set( p_heap, i, p_output );
+}
+
+/*****************************************************************************
+ * heap_Down : move an output away from the root until its children are due
+ * after it
+ *****************************************************************************/
+static void heap_Down( output_heap_t *p_heap, int i )
+{
+    output_t *p_output = p_heap->pp_outputs[i];
+
+    for ( ; ; )
+    {
+        int i_child = 2 * i + 1;
+        if ( i_child >= p_heap->i_nb_outputs )
+            break;
+        if ( i_child + 1 < p_heap->i_nb_outputs
+              && p_heap->pp_outputs[i_child + 1]->i_heap_date
+                  < p_heap->pp_outputs[i_child]->i_heap_date )
+            i_child++;
+        if ( p_output->i_heap_date <= p_heap->pp_outputs[i_child]->i_heap_date )
+            break;
+        heap_Set( p_heap, i, p_heap->pp_outputs[i_child] );
+        i = i_child;
+    }
+    heap_Set( p_heap, i, p_output );
+}
+
+/*****************************************************************************
+ * heap_Remove : take an output out of the heap
+ *****************************************************************************/
+static void heap_Remove( output_heap_t *p_heap, output_t *p_output )
+{
+    int i = p_output->i_heap_index;
+    output_t *p_last;
+
+    if ( i < 0 )
+        return;
+    p_output->i_heap_index = -1;
+
+    p_last = p_heap->pp_outputs[--p_heap->i_nb_outputs];
+    if ( p_last == p_output )
+        return;
+    heap_Set( p_heap, i, p_last );
+    heap_Up( p_heap, i );
+    heap_Down( p_heap, p_last->i_heap_index );
+}
+
+/*****************************************************************************
+ * output_Schedule : update the position of an output in the heap of its
+ * thread after its first packet changed; the heap date may be earlier than
+ * the actual due date, the output is then only flushed once too early
+ *****************************************************************************/
+static void output_Schedule( output_t *p_output )
+{
+    output_heap_t *p_heap = p_output->p_worker != NULL ?
+                            &p_output->p_worker->heap : &output_heap;
+
+    if ( p_output->p_packets == NULL
+          || !(p_output->config.i_config & OUTPUT_VALID) )
+    {
+        heap_Remove( p_heap, p_output );
+        return;
+    }
+
+    p_output->i_heap_date = output_Due( p_output, p_output->p_packets );
+    if ( p_output->i_heap_index < 0 )
+    {
+        if ( p_heap->i_nb_outputs == p_heap->i_max_outputs )
+        {
+            p_heap->i_max_outputs = p_heap->i_max_outputs ?
+                                    2 * p_heap->i_max_outputs : 16;
+            p_heap->pp_outputs = realloc( p_heap->pp_outputs,
+                                p_heap->i_max_outputs * sizeof(output_t *) );
+        }
+        p_output->i_heap_index = p_heap->i_nb_outputs++;
+        p_heap->pp_outputs[p_output->i_heap_index] = p_output;
+    }
+    heap_Up( p_heap, p_output->i_heap_index );
+    heap_Down( p_heap, p_output->i_heap_index );
+}
+
+/*****************************************************************************
+ * output_Queued : schedule an output after packets were appended, only if
+ * its first packet is due earlier than planned
+ *****************************************************************************/
+static inline void output_Queued( output_t *p_output )
+{
+    if ( p_output->p_packets != NULL
+          && (p_output->i_heap_index < 0
+               || output_Due( p_output, p_output->p_packets )
+                   < p_output->i_heap_date) )
+        output_Schedule( p_output );
+}
+
+/*****************************************************************************
+ * outputs_Rearm : start the send timer earlier if needed (main thread)
+ *****************************************************************************/
+static void outputs_Rearm( void )
+{
+    if ( !output_heap.i_nb_outputs
+          || output_heap.pp_outputs[0]->i_heap_date >= i_next_send )
+        return;
+
+    i_next_send = output_heap.pp_outputs[0]->i_heap_date;
+    ev_timer_stop(event_loop, &output_watcher);
+    ev_timer_set(&output_watcher, (i_next_send - i_wallclock) / 1000000., 0);
+    ev_timer_start(event_loop, &output_watcher);
+}
+
 /*****************************************************************************
  * output_Create : create and insert the output_t structure
  *****************************************************************************/
@@ -237,6 +760,9 @@ int output_Init( output_t *p_output, const output_config_t *p_config )
 
     memset( p_output, 0, sizeof(output_t) );
     config_Init( &p_output->config );
+    p_output->i_uring_file = -1;
+    p_output->i_heap_index = -1;
+    p_output->i_cbr_date = -1;
 
     /* Init run-time values */
     p_output->p_packets = p_output->p_last_packet = NULL;
@@ -264,6 +790,34 @@ int output_Init( output_t *p_output, const output_config_t *p_config )
     /* Init the mapped pids to unused */
     init_pid_mapping( p_output );
 
+    if ( p_config->i_config & OUTPUT_FILE )
+    {
+        p_output->i_handle = -1;
+        p_output->config.i_config |= OUTPUT_FILE;
+        p_output->config.psz_path = strdup( p_config->psz_path );
+        p_output->p_record = record_Open( p_config );
+        if ( p_output->p_record == NULL )
+        {
+            p_output->config.i_config &= ~OUTPUT_VALID;
+            return -1;
+        }
+        goto assign;
+    }
+
+    if ( p_config->i_config & OUTPUT_HTTP )
+    {
+        p_output->i_handle = -1;
+        p_output->config.i_config |= OUTPUT_HTTP;
+        p_output->config.psz_path = strdup( p_config->psz_path );
+        p_output->p_stream = http_StreamOpen( p_config );
+        if ( p_output->p_stream == NULL )
+        {
+            p_output->config.i_config &= ~OUTPUT_VALID;
+            return -1;
+        }
+        goto assign;
+    }
+
     /* Init socket-related fields */
     p_output->config.i_family = p_config->i_family;
     memcpy( &p_output->config.connect_addr, &p_config->connect_addr,
@@ -274,7 +828,7 @@ int output_Init( output_t *p_output, const output_config_t *p_config )
 
     if ( (p_config->i_config & OUTPUT_RAW) ) {
         p_output->config.i_config |= OUTPUT_RAW;
-        p_output->i_handle = socket( AF_INET, SOCK_RAW, IPPROTO_RAW );
+        p_output->i_handle = socket( p_config->i_family, SOCK_RAW, IPPROTO_RAW );
     } else {
         p_output->i_handle = socket( p_config->i_family, SOCK_DGRAM, IPPROTO_UDP );
     }
@@ -307,7 +861,17 @@ int output_Init( output_t *p_output, const output_config_t *p_config )
         }
     }
 
-    if ( (p_config->i_config & OUTPUT_RAW) )
+    if ( (p_config->i_config & OUTPUT_RAW) && p_config->i_family == AF_INET6 )
+    {
+        /* We send the IPv6 header, the kernel doesn't fill it */
+        int i_on = 1;
+        if ( setsockopt( p_output->i_handle, IPPROTO_IPV6, IPV6_HDRINCL,
+                         &i_on, sizeof(i_on) ) < 0 )
+            msg_Warn( NULL, "couldn't set IPV6_HDRINCL (%s)", strerror(errno) );
+        Raw6FillHeaders( p_output, p_config->psz_srcaddr, p_config->i_srcport,
+                         p_config->i_ttl, p_config->i_tos );
+    }
+    else if ( (p_config->i_config & OUTPUT_RAW) )
     {
         struct sockaddr_in *p_connect_addr =
             (struct sockaddr_in *)&p_output->config.connect_addr;
@@ -332,8 +896,10 @@ int output_Init( output_t *p_output, const output_config_t *p_config )
         msg_Warn( NULL, "couldn't join multicast address (%s)",
                   strerror(errno) );
 
-    if ( connect( p_output->i_handle,
-                  (struct sockaddr *)&p_output->config.connect_addr,
+    struct sockaddr_storage connect_addr = p_output->config.connect_addr;
+    if ( (p_config->i_config & OUTPUT_RAW) && p_config->i_family == AF_INET6 )
+        ((struct sockaddr_in6 *)&connect_addr)->sin6_port = 0; /* protocol */
+    if ( connect( p_output->i_handle, (struct sockaddr *)&connect_addr,
                   i_sockaddr_len ) < 0 )
     {
         msg_Err( NULL, "couldn't connect socket (%s)", strerror(errno) );
@@ -342,6 +908,24 @@ int output_Init( output_t *p_output, const output_config_t *p_config )
         return -errno;
     }
 
+#ifdef HAVE_IO_URING
+    if ( b_io_uring )
+        p_output->i_uring_file = uring_AddFile( p_output->i_handle );
+#endif
+
+assign:
+    /* The HTTP clients are served by the main thread */
+    if ( i_output_threads && p_output->p_stream == NULL )
+    {
+        /* Called with the outputs locked */
+        output_worker_t *p_worker = &p_workers[i_next_worker++
+                                               % i_output_threads];
+        p_worker->pp_outputs = realloc( p_worker->pp_outputs,
+                (p_worker->i_nb_outputs + 1) * sizeof(output_t *) );
+        p_worker->pp_outputs[p_worker->i_nb_outputs++] = p_output;
+        p_output->p_worker = p_worker;
+    }
+
     p_output->config.i_config |= OUTPUT_VALID;
 
     return 0;
@@ -358,15 +942,13 @@ void output_Close( output_t *p_output )
         int i;
 
         for ( i = 0; i < p_packet->i_depth; i++ )
-        {
-            p_packet->pp_blocks[i]->i_refcount--;
-            if ( !p_packet->pp_blocks[i]->i_refcount )
-                block_Delete( p_packet->pp_blocks[i] );
-        }
+            output_BlockRelease( p_packet->pp_blocks[i] );
         p_output->p_packets = p_packet->p_next;
         output_PacketDelete( p_output, p_packet );
         p_packet = p_output->p_packets;
     }
+    /* The history returns its packets to the LIFO */
+    output_SetRetx( p_output, 0 );
     output_PacketVacuum( p_output );
 
     p_output->p_packets = p_output->p_last_packet = NULL;
@@ -376,123 +958,1008 @@ void output_Close( output_t *p_output )
     free( p_output->p_sdt_section );
     free( p_output->p_eit_ts_buffer );
     p_output->config.i_config &= ~OUTPUT_VALID;
+    output_Schedule( p_output );
+    output_SetRTCP( p_output, false );
+
+#ifdef HAVE_IO_URING
+    uring_DelFile( p_output->i_uring_file );
+    p_output->i_uring_file = -1;
+#endif
+    if ( p_output->p_record != NULL )
+    {
+        record_Close( p_output->p_record );
+        p_output->p_record = NULL;
+    }
+    else if ( p_output->p_stream != NULL )
+    {
+        http_StreamClose( p_output->p_stream );
+        p_output->p_stream = NULL;
+    }
+    else
+        close( p_output->i_handle );
+
+    if ( p_output->p_worker != NULL )
+    {
+        /* Called with the outputs locked */
+        output_worker_t *p_worker = p_output->p_worker;
+        int i;
 
-    close( p_output->i_handle );
+        for ( i = 0; i < p_worker->i_nb_outputs; i++ )
+            if ( p_worker->pp_outputs[i] == p_output )
+                break;
+        if ( i < p_worker->i_nb_outputs )
+            p_worker->pp_outputs[i] = p_worker->pp_outputs[--p_worker->i_nb_outputs];
+        p_output->p_worker = NULL;
+    }
 
     config_Free( &p_output->config );
 }
 
 /*****************************************************************************
- * output_Flush
+ * output_CountBatch : account for i_msgs datagrams sent in one call
  *****************************************************************************/
-static void output_Flush( output_t *p_output )
+static void output_CountBatch( unsigned int i_msgs )
 {
-    packet_t *p_packet = p_output->p_packets;
-    int i_block_cnt = output_BlockCount( p_output );
-    struct iovec p_iov[i_block_cnt + 2];
-    uint8_t p_rtp_hdr[RTP_HEADER_SIZE];
-    int i_iov = 0, i_payload_len, i_block;
+    int i_bucket = 0;
 
-    if ( (p_output->config.i_config & OUTPUT_RAW) )
-    {
-        p_iov[i_iov].iov_base = &p_output->raw_pkt_header;
-        p_iov[i_iov].iov_len = sizeof(struct udprawpkt);
-        i_iov++;
-    }
+    __atomic_fetch_add( &i_send_datagrams, i_msgs, __ATOMIC_RELAXED );
+    if ( i_msgs > __atomic_load_n( &i_send_max_batch, __ATOMIC_RELAXED ) )
+        __atomic_store_n( &i_send_max_batch, i_msgs, __ATOMIC_RELAXED );
 
-    if ( !(p_output->config.i_config & OUTPUT_UDP) )
-    {
-        p_iov[i_iov].iov_base = p_rtp_hdr;
-        p_iov[i_iov].iov_len = sizeof(p_rtp_hdr);
+    while ( (i_msgs >> (i_bucket + 1)) && i_bucket < OUTPUT_HISTOGRAM_SIZE - 1 )
+        i_bucket++;
+    __atomic_fetch_add( &pi_send_histogram[i_bucket], 1, __ATOMIC_RELAXED );
+}
 
-        rtp_set_hdr( p_rtp_hdr );
-        rtp_set_type( p_rtp_hdr, RTP_TYPE_TS );
-        rtp_set_seqnum( p_rtp_hdr, p_output->i_seqnum++ );
-        /* New timestamp based only on local time when sent */
-        /* 90 kHz clock = 90000 counts per second */
-        rtp_set_timestamp( p_rtp_hdr, i_wallclock * 9 / 100);
-        rtp_set_ssrc( p_rtp_hdr, p_output->config.pi_ssrc );
+/*****************************************************************************
+ * output_RestampPCR : add i_delay to the PCR of a TS packet
+ *****************************************************************************/
+static void output_RestampPCR( uint8_t *p_ts, mtime_t i_delay )
+{
+    uint64_t i_pcr = tsaf_get_pcr( p_ts ) * 300 + tsaf_get_pcrext( p_ts );
+    int64_t i_ticks = (i_delay * 27) % (int64_t)PCR_WRAP;
 
-        i_iov++;
+    i_pcr = (i_pcr + PCR_WRAP + i_ticks) % PCR_WRAP;
+    tsaf_set_pcr( p_ts, i_pcr / 300 );
+    tsaf_set_pcrext( p_ts, i_pcr % 300 );
+}
+
+/*****************************************************************************
+ * output_AddTS : add a TS packet to an iovec, returns the number of entries;
+ * with b_split the header is taken from p_hdr and the payload from p_ts
+ *****************************************************************************/
+static inline int output_AddTS( struct iovec *p_iov, const uint8_t *p_hdr,
+                                const uint8_t *p_ts, bool b_split )
+{
+    if ( !b_split )
+    {
+        p_iov[0].iov_base = (void *)p_ts;
+        p_iov[0].iov_len = TS_SIZE;
+        return 1;
     }
 
+    p_iov[0].iov_base = (void *)p_hdr;
+    p_iov[0].iov_len = TS_HEADER_SIZE;
+    p_iov[1].iov_base = (void *)(p_ts + TS_HEADER_SIZE);
+    p_iov[1].iov_len = TS_SIZE - TS_HEADER_SIZE;
+    return 2;
+}
+
+/*****************************************************************************
+ * output_FillPayload : add the TS packets of a packet to p_iov, padded to
+ * the size of the datagram, returns the number of entries; blocks are
+ * shared with the other outputs and threads and are never modified, remapped
+ * headers are written to p_hdrs and restamped packets to p_copies
+ *****************************************************************************/
+static int output_FillPayload( output_t *p_output, packet_t *p_packet,
+                               struct iovec *p_iov,
+                               uint8_t (*p_hdrs)[TS_HEADER_SIZE],
+                               uint8_t (*p_copies)[TS_SIZE] )
+{
+    int i_block_cnt = output_BlockCount( p_output );
+    int i_iov = 0, i_block;
+    bool b_remap = b_do_remap || p_output->config.b_do_remap;
+    bool b_restamp = p_output->config.i_cbr
+                      || (p_output->config.i_config & OUTPUT_RESTAMP);
+
     for ( i_block = 0; i_block < p_packet->i_depth; i_block++ )
     {
-        /* Do pid mapping here if needed.
-         * save the original pid in the block.
-         * set the pid to the new pid
-         * later we re-instate the old pid for the next output
-         */
-        if ( b_do_remap || p_output->config.b_do_remap ) {
-            block_t *p_block = p_packet->pp_blocks[i_block];
-            uint16_t i_pid = ts_get_pid( p_block->p_ts );
-            p_block->tmp_pid = UNUSED_PID;
+        block_t *p_block = p_packet->pp_blocks[i_block];
+        const uint8_t *p_ts = p_block->p_ts;
+        const uint8_t *p_hdr = p_ts;
+
+        if ( b_restamp && ts_has_adaptation( p_ts ) && ts_get_adaptation( p_ts )
+              && tsaf_has_pcr( p_ts ) )
+        {
+            /* Correct the PCR for the time spent in the queue */
+            memcpy( p_copies[i_block], p_ts, TS_SIZE );
+            output_RestampPCR( p_copies[i_block],
+                               p_packet->i_sent - p_block->i_dts );
+            p_ts = p_hdr = p_copies[i_block];
+        }
+
+        if ( b_remap )
+        {
+            uint16_t i_pid = ts_get_pid( p_ts );
             if ( p_output->pi_newpids[i_pid] != UNUSED_PID )
             {
-                uint16_t i_newpid = p_output->pi_newpids[i_pid];
-                /* Need to map this pid to the new pid */
-                ts_set_pid( p_block->p_ts, i_newpid );
-                p_block->tmp_pid = i_pid;
+                memcpy( p_hdrs[i_block], p_ts, TS_HEADER_SIZE );
+                ts_set_pid( p_hdrs[i_block], p_output->pi_newpids[i_pid] );
+                p_hdr = p_hdrs[i_block];
             }
         }
 
-        p_iov[i_iov].iov_base = p_packet->pp_blocks[i_block]->p_ts;
-        p_iov[i_iov].iov_len = TS_SIZE;
-        i_iov++;
+        i_iov += output_AddTS( p_iov + i_iov, p_hdr, p_ts, b_remap );
     }
 
     for ( ; i_block < i_block_cnt; i_block++ )
     {
-        p_iov[i_iov].iov_base = p_pad_ts;
-        p_iov[i_iov].iov_len = TS_SIZE;
-        i_iov++;
-    }
-
-    
-    if ( (p_output->config.i_config & OUTPUT_RAW) )
-    {
-        i_payload_len = 0;
-        for ( i_block = 1; i_block < i_iov; i_block++ ) {
-            i_payload_len += p_iov[i_block].iov_len; 
-        }
-        p_output->raw_pkt_header.udph.len = htons(sizeof(struct udpheader) + i_payload_len);
-    }
+        int i_first = i_iov;
+        i_iov += output_AddTS( p_iov + i_iov, p_pad_ts, p_pad_ts, b_remap );
 
-    if ( writev( p_output->i_handle, p_iov, i_iov ) < 0 )
-    {
-        msg_Err( NULL, "couldn't writev to %s (%s)",
-                 p_output->config.psz_displayname, strerror(errno) );
+        /* Files and HTTP streams are not padded */
+        for ( ; (p_output->config.i_config & (OUTPUT_FILE | OUTPUT_HTTP))
+                 && i_first < i_iov; i_first++ )
+            p_iov[i_first].iov_len = 0;
     }
-    /* Update the wallclock because writev() can take some time. */
-    i_wallclock = mdate();
 
-    for ( i_block = 0; i_block < p_packet->i_depth; i_block++ )
-    {
-        p_packet->pp_blocks[i_block]->i_refcount--;
-        if ( !p_packet->pp_blocks[i_block]->i_refcount )
-            block_Delete( p_packet->pp_blocks[i_block] );
-        else if ( b_do_remap || p_output->config.b_do_remap ) {
-            /* still referenced so re-instate the orignial pid if remapped */
-            block_t * p_block = p_packet->pp_blocks[i_block];
-            if (p_block->tmp_pid != UNUSED_PID)
-                ts_set_pid( p_block->p_ts, p_block->tmp_pid );
-        }
-    }
-    p_output->p_packets = p_packet->p_next;
-    output_PacketDelete( p_output, p_packet );
-    if ( p_output->p_packets == NULL )
-        p_output->p_last_packet = NULL;
+    return i_iov;
 }
 
 /*****************************************************************************
- * output_Put : called from demux
+ * output_FillMsg : build the datagram of a packet in p_iov; the headers of
+ * IPv6 RAW outputs depend on the payload and are written to p_raw6_hdr
  *****************************************************************************/
-void output_Put( output_t *p_output, block_t *p_block )
+static void output_FillMsg( output_t *p_output, packet_t *p_packet,
+                            uint8_t *p_rtp_hdr, struct iovec *p_iov,
+                            uint8_t (*p_hdrs)[TS_HEADER_SIZE],
+                            uint8_t (*p_copies)[TS_SIZE],
+                            struct udpraw6pkt *p_raw6_hdr )
 {
-    int i_block_cnt = output_BlockCount( p_output );
-    packet_t *p_packet;
+    int i_iov = 0, i_payload_len, i;
 
-    p_block->i_refcount++;
+    /* departure date minus the latency, kept for retransmissions */
+    p_packet->i_sent = p_packet->i_dts;
+    if ( (p_output->config.i_config & OUTPUT_RESTAMP) && !p_output->b_txtime )
+        p_packet->i_sent = i_wallclock - p_output->config.i_output_latency;
+    p_packet->i_send_date = i_wallclock;
+
+    if ( (p_output->config.i_config & OUTPUT_RAW)
+          && p_output->config.i_family == AF_INET6 )
+    {
+        p_iov[i_iov].iov_base = p_raw6_hdr;
+        p_iov[i_iov].iov_len = sizeof(struct udpraw6pkt);
+        i_iov++;
+    }
+    else if ( (p_output->config.i_config & OUTPUT_RAW) )
+    {
+        p_iov[i_iov].iov_base = &p_output->raw_pkt_header;
+        p_iov[i_iov].iov_len = sizeof(struct udprawpkt);
+        i_iov++;
+    }
+
+    if ( !(p_output->config.i_config & OUTPUT_UDP) )
+    {
+        p_iov[i_iov].iov_base = p_rtp_hdr;
+        p_iov[i_iov].iov_len = RTP_HEADER_SIZE;
+
+        p_packet->i_seqnum = p_output->i_seqnum++;
+        rtp_set_hdr( p_rtp_hdr );
+        rtp_set_type( p_rtp_hdr, RTP_TYPE_TS );
+        rtp_set_seqnum( p_rtp_hdr, p_packet->i_seqnum );
+        /* New timestamp based only on local time when sent */
+        /* 90 kHz clock = 90000 counts per second */
+        rtp_set_timestamp( p_rtp_hdr, i_wallclock * 9 / 100);
+        rtp_set_ssrc( p_rtp_hdr, p_output->config.pi_ssrc );
+
+        i_iov++;
+    }
+
+    i_iov += output_FillPayload( p_output, p_packet, p_iov + i_iov,
+                                 p_hdrs, p_copies );
+
+    if ( (p_output->config.i_config & OUTPUT_RAW)
+          && p_output->config.i_family == AF_INET6 )
+        output_Raw6Header( p_output, p_raw6_hdr, p_iov + 1, i_iov - 1 );
+    else if ( (p_output->config.i_config & OUTPUT_RAW) )
+    {
+        i_payload_len = 0;
+        for ( i = 1; i < i_iov; i++ ) {
+            i_payload_len += p_iov[i].iov_len;
+        }
+        p_output->raw_pkt_header.udph.len = htons(sizeof(struct udpheader) + i_payload_len);
+    }
+}
+
+/*****************************************************************************
+ * output_BuildMsgs : group the datagrams i_first to i_last - 1 of the batch
+ * in messages of up to i_segs UDP_SEGMENT segments, returns the number of
+ * messages; with b_txtime each message leaves at the launch time of its
+ * first datagram
+ *****************************************************************************/
+static int output_BuildMsgs( int i_first, int i_last, int i_stride,
+                             int i_segs, uint16_t i_seg_size, bool b_txtime )
+{
+    int i_msgs = 0;
+
+    while ( i_first < i_last )
+    {
+        struct msghdr *p_hdr = &p_send_msgs[i_msgs].msg_hdr;
+        int i_nb = i_last - i_first < i_segs ? i_last - i_first : i_segs;
+        uint8_t *p_cmsg_buf = p_send_cmsgs[i_msgs].p_buf;
+        size_t i_controllen = 0;
+
+        memset( p_hdr, 0, sizeof(struct msghdr) );
+        p_hdr->msg_iov = p_send_iov + i_first * i_stride;
+        p_hdr->msg_iovlen = i_nb * i_stride;
+#ifdef HAVE_UDP_GSO
+        if ( i_nb > 1 )
+        {
+            struct cmsghdr *p_cmsg = (struct cmsghdr *)p_cmsg_buf;
+
+            p_cmsg->cmsg_level = SOL_UDP;
+            p_cmsg->cmsg_type = UDP_SEGMENT;
+            p_cmsg->cmsg_len = CMSG_LEN( sizeof(uint16_t) );
+            memcpy( CMSG_DATA( p_cmsg ), &i_seg_size, sizeof(uint16_t) );
+            i_controllen += CMSG_SPACE( sizeof(uint16_t) );
+        }
+#endif
+#ifdef HAVE_SO_TXTIME
+        if ( b_txtime )
+        {
+            struct cmsghdr *p_cmsg =
+                (struct cmsghdr *)(p_cmsg_buf + i_controllen);
+
+            p_cmsg->cmsg_level = SOL_SOCKET;
+            p_cmsg->cmsg_type = SCM_TXTIME;
+            p_cmsg->cmsg_len = CMSG_LEN( sizeof(uint64_t) );
+            memcpy( CMSG_DATA( p_cmsg ), &pi_send_txtimes[i_first],
+                    sizeof(uint64_t) );
+            i_controllen += CMSG_SPACE( sizeof(uint64_t) );
+        }
+#endif
+        if ( i_controllen )
+        {
+            p_hdr->msg_control = p_cmsg_buf;
+            p_hdr->msg_controllen = i_controllen;
+        }
+        pi_send_segs[i_msgs++] = i_nb;
+        i_first += i_nb;
+    }
+
+    return i_msgs;
+}
+
+/*****************************************************************************
+ * output_SendMsgs : send i_msgs messages on the output socket, returns the
+ * index of the first segmented message the kernel can't segment, or i_msgs
+ *****************************************************************************/
+static int output_SendMsgs( output_t *p_output, int i_msgs )
+{
+    int i_sent = 0;
+
+    while ( i_sent < i_msgs )
+    {
+        int i_ret, i, i_datagrams = 0;
+#ifdef HAVE_SENDMMSG
+        i_ret = sendmmsg( p_output->i_handle, p_send_msgs + i_sent,
+                          i_msgs - i_sent, 0 );
+#else
+        i_ret = writev( p_output->i_handle,
+                        p_send_msgs[i_sent].msg_hdr.msg_iov,
+                        p_send_msgs[i_sent].msg_hdr.msg_iovlen ) < 0 ? -1 : 1;
+#endif
+        __atomic_fetch_add( &i_send_syscalls, 1, __ATOMIC_RELAXED );
+
+        if ( i_ret < 0 )
+        {
+            if ( pi_send_segs[i_sent] > 1
+                  && (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT) )
+                return i_sent;
+
+            msg_Err( NULL, "couldn't send to %s (%s)",
+                     p_output->config.psz_displayname, strerror(errno) );
+            /* The error belongs to the first message, skip it */
+            i_sent++;
+            continue;
+        }
+
+        for ( i = 0; i < i_ret; i++ )
+            i_datagrams += pi_send_segs[i_sent + i];
+        output_CountBatch( i_datagrams );
+        i_sent += i_ret;
+    }
+
+    return i_msgs;
+}
+
+#ifdef HAVE_IO_URING
+/*****************************************************************************
+ * output_QueueMsgs : queue the datagrams of the batch to io_uring, the ones
+ * it can't take are sent synchronously
+ *****************************************************************************/
+static void output_QueueMsgs( output_t *p_output, int i_packets, int i_stride )
+{
+    int i, i_queued = 0;
+
+    for ( i = 0; i < i_packets; i++ )
+    {
+        if ( uring_Queue( p_output->i_uring_file, p_send_iov + i * i_stride,
+                          i_stride ) == 0 )
+            i_queued++;
+        else
+            output_SendMsgs( p_output,
+                             output_BuildMsgs( i, i + 1, i_stride, 1, 0,
+                                               false ) );
+    }
+
+    if ( i_queued )
+    {
+        __atomic_fetch_add( &i_send_syscalls, uring_Submit(),
+                            __ATOMIC_RELAXED );
+        output_CountBatch( i_queued );
+    }
+}
+#endif
+
+/*****************************************************************************
+ * output_Reserve : grow the send buffers of the thread for OUTPUT_BATCH_MAX
+ * datagrams of i_stride entries
+ *****************************************************************************/
+static void output_Reserve( output_t *p_output, int i_stride )
+{
+    int i_block_cnt = output_BlockCount( p_output );
+
+    if ( i_stride * OUTPUT_BATCH_MAX > i_send_iov_size )
+    {
+        i_send_iov_size = i_stride * OUTPUT_BATCH_MAX;
+        p_send_iov = realloc( p_send_iov,
+                              i_send_iov_size * sizeof(struct iovec) );
+    }
+    if ( (b_do_remap || p_output->config.b_do_remap)
+          && i_block_cnt * OUTPUT_BATCH_MAX > i_remap_size )
+    {
+        i_remap_size = i_block_cnt * OUTPUT_BATCH_MAX;
+        p_remap_hdrs = realloc( p_remap_hdrs, i_remap_size * TS_HEADER_SIZE );
+    }
+    if ( (p_output->config.i_cbr
+           || (p_output->config.i_config & OUTPUT_RESTAMP))
+          && i_block_cnt * OUTPUT_BATCH_MAX > i_copy_size )
+    {
+        i_copy_size = i_block_cnt * OUTPUT_BATCH_MAX;
+        p_copy_ts = realloc( p_copy_ts, i_copy_size * TS_SIZE );
+    }
+}
+
+/*****************************************************************************
+ * output_HistoryDrop : release the oldest packet of the retransmission
+ * history
+ *****************************************************************************/
+static void output_HistoryDrop( output_t *p_output )
+{
+    output_retx_t *p_retx = p_output->p_retx;
+    packet_t **pp_packet =
+        &p_retx->pp_history[p_retx->i_first & (RETX_HISTORY_SIZE - 1)];
+    int i;
+
+    for ( i = 0; i < (*pp_packet)->i_depth; i++ )
+        output_BlockRelease( (*pp_packet)->pp_blocks[i] );
+    output_PacketDelete( p_output, *pp_packet );
+    *pp_packet = NULL;
+    p_retx->i_first++;
+    p_retx->i_count--;
+}
+
+/*****************************************************************************
+ * output_HistoryAdd : keep a sent packet, and its blocks, for
+ * retransmission; packets older than /retx are released
+ *****************************************************************************/
+static void output_HistoryAdd( output_t *p_output, packet_t *p_packet )
+{
+    output_retx_t *p_retx = p_output->p_retx;
+
+    if ( p_retx->i_count == RETX_HISTORY_SIZE )
+        output_HistoryDrop( p_output );
+    if ( !p_retx->i_count )
+        p_retx->i_first = p_packet->i_seqnum;
+
+    p_packet->i_retx_date = INT64_MIN;
+    p_retx->pp_history[p_packet->i_seqnum & (RETX_HISTORY_SIZE - 1)] = p_packet;
+    p_retx->i_count++;
+
+    while ( p_retx->i_count
+             && p_retx->pp_history[p_retx->i_first & (RETX_HISTORY_SIZE - 1)]
+                  ->i_send_date + p_output->config.i_retx < i_wallclock )
+        output_HistoryDrop( p_output );
+}
+
+/*****************************************************************************
+ * output_Retransmit : resend the packets of the history with the given
+ * sequence numbers, as RFC 4588 datagrams (main thread, with the sender
+ * thread of the output locked)
+ *****************************************************************************/
+static void output_Retransmit( output_t *p_output, const uint16_t *pi_seqnums,
+                               int i_nb )
+{
+    output_retx_t *p_retx = p_output->p_retx;
+    int i_block_cnt = output_BlockCount( p_output );
+    int i_stride = i_block_cnt * ((b_do_remap || p_output->config.b_do_remap)
+                                   ? 2 : 1) + 2;
+    uint8_t pp_osns[OUTPUT_BATCH_MAX][2];
+    uint64_t i_now = 0;
+    int i_packets = 0, i;
+
+    output_Reserve( p_output, i_stride );
+    i_wallclock = mdate();
+
+#ifdef HAVE_SO_TXTIME
+    if ( p_output->b_txtime )
+    {
+        /* Leave now */
+        struct timespec ts;
+        clock_gettime( p_output->config.b_txtime_tai ? CLOCK_TAI
+                        : CLOCK_MONOTONIC, &ts );
+        i_now = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+#endif
+
+    for ( i = 0; i <= i_nb; i++ )
+    {
+        packet_t *p_packet;
+        struct iovec *p_iov;
+
+        if ( i_packets == OUTPUT_BATCH_MAX || (i == i_nb && i_packets) )
+        {
+            output_SendMsgs( p_output,
+                             output_BuildMsgs( 0, i_packets, i_stride, 1, 0,
+                                               p_output->b_txtime ) );
+            i_packets = 0;
+        }
+        if ( i == i_nb )
+            break;
+
+        if ( (uint16_t)(pi_seqnums[i] - p_retx->i_first) >= p_retx->i_count )
+            continue; /* not in the history anymore */
+        p_packet = p_retx->pp_history[pi_seqnums[i] & (RETX_HISTORY_SIZE - 1)];
+        if ( p_packet->i_retx_date + RETX_HOLDOFF > i_wallclock )
+            continue; /* already resent */
+        p_packet->i_retx_date = i_wallclock;
+
+        p_iov = p_send_iov + i_packets * i_stride;
+        p_iov[0].iov_base = pp_rtp_hdrs[i_packets];
+        p_iov[0].iov_len = RTP_HEADER_SIZE;
+        rtp_set_hdr( pp_rtp_hdrs[i_packets] );
+        rtp_set_type( pp_rtp_hdrs[i_packets], RETX_PAYLOAD_TYPE );
+        rtp_set_seqnum( pp_rtp_hdrs[i_packets], p_retx->i_seqnum++ );
+        rtp_set_timestamp( pp_rtp_hdrs[i_packets],
+                           p_packet->i_send_date * 9 / 100 );
+        rtp_set_ssrc( pp_rtp_hdrs[i_packets], p_retx->pi_ssrc );
+
+        /* Original sequence number */
+        pp_osns[i_packets][0] = p_packet->i_seqnum >> 8;
+        pp_osns[i_packets][1] = p_packet->i_seqnum & 0xff;
+        p_iov[1].iov_base = pp_osns[i_packets];
+        p_iov[1].iov_len = 2;
+
+        output_FillPayload( p_output, p_packet, p_iov + 2,
+                            p_remap_hdrs + i_packets * i_block_cnt,
+                            p_copy_ts + i_packets * i_block_cnt );
+        pi_send_txtimes[i_packets] = i_now;
+        i_packets++;
+        p_output->p_rtcp->i_retransmitted++;
+    }
+}
+
+/*****************************************************************************
+ * output_NextPort : add one to the port of an address
+ *****************************************************************************/
+static void output_NextPort( struct sockaddr_storage *p_addr )
+{
+    if ( p_addr->ss_family == AF_INET6 )
+    {
+        struct sockaddr_in6 *p_addr6 = (struct sockaddr_in6 *)p_addr;
+        p_addr6->sin6_port = htons( ntohs( p_addr6->sin6_port ) + 1 );
+    }
+    else
+    {
+        struct sockaddr_in *p_addr4 = (struct sockaddr_in *)p_addr;
+        p_addr4->sin_port = htons( ntohs( p_addr4->sin_port ) + 1 );
+    }
+}
+
+/*****************************************************************************
+ * output_NTPDate : current time in the NTP format, 32.32 fixed point
+ *****************************************************************************/
+static uint64_t output_NTPDate( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_REALTIME, &ts );
+    return ((uint64_t)ts.tv_sec + NTP_EPOCH_OFFSET) << 32
+            | ((uint64_t)ts.tv_nsec << 32) / 1000000000;
+}
+
+/*****************************************************************************
+ * output_RTCPReport : handles the report blocks of an RR or SR (RFC 3550)
+ *****************************************************************************/
+static void output_RTCPReport( output_t *p_output, const uint8_t *p_rtcp,
+                               ssize_t i_len )
+{
+    output_rtcp_t *p_rtcp_state = p_output->p_rtcp;
+    int i_count = p_rtcp[0] & 0x1f;
+    ssize_t i_block = p_rtcp[1] == RTCP_PT_SR ? 28 : 8;
+
+    for ( ; i_count && i_block + 24 <= i_len; i_count--, i_block += 24 )
+    {
+        const uint8_t *p_block = p_rtcp + i_block;
+        uint32_t i_lsr, i_dlsr, i_jitter;
+        int32_t i_lost;
+
+        if ( memcmp( p_block, p_output->config.pi_ssrc, 4 ) )
+            continue;
+
+        i_lost = p_block[5] << 16 | p_block[6] << 8 | p_block[7];
+        if ( i_lost & 0x800000 )
+            i_lost -= 0x1000000; /* 24-bit signed */
+        i_jitter = (uint32_t)p_block[12] << 24 | p_block[13] << 16
+                    | p_block[14] << 8 | p_block[15];
+        i_lsr = (uint32_t)p_block[16] << 24 | p_block[17] << 16
+                 | p_block[18] << 8 | p_block[19];
+        i_dlsr = (uint32_t)p_block[20] << 24 | p_block[21] << 16
+                  | p_block[22] << 8 | p_block[23];
+
+        p_rtcp_state->i_reports++;
+        p_rtcp_state->i_report_date = i_wallclock;
+        p_rtcp_state->i_fraction_lost = p_block[4];
+        p_rtcp_state->i_cumulative_lost = i_lost;
+        p_rtcp_state->i_jitter = (mtime_t)i_jitter * 100 / 9;
+        if ( i_lsr )
+        {
+            /* Middle 32 bits of the NTP dates, in 1/65536 s */
+            uint32_t i_now = output_NTPDate() >> 16;
+            p_rtcp_state->i_rtt = (mtime_t)(uint32_t)(i_now - i_lsr - i_dlsr)
+                                   * 1000000 / 65536;
+        }
+    }
+}
+
+/*****************************************************************************
+ * output_RTCPRead : handles the receiver reports, and the Generic NACKs
+ * (RFC 4585) with /retx
+ *****************************************************************************/
+static void output_RTCPRead( struct ev_loop *loop, struct ev_io *w,
+                             int revents )
+{
+    output_rtcp_t *p_rtcp_state = w->data;
+    output_t *p_output = p_rtcp_state->p_output;
+    uint8_t p_buffer[RTCP_MAX_SIZE];
+    uint16_t pi_seqnums[RTCP_MAX_SIZE / 4 * 17];
+    ssize_t i_size;
+
+    i_wallclock = mdate();
+
+    while ( (i_size = recv( p_rtcp_state->i_handle, p_buffer,
+                            sizeof(p_buffer), MSG_DONTWAIT )) > 0 )
+    {
+        uint8_t *p_rtcp = p_buffer;
+        int i_nb = 0;
+
+        while ( i_size >= 4 && (p_rtcp[0] >> 6) == 2 )
+        {
+            ssize_t i_len = ((p_rtcp[2] << 8 | p_rtcp[3]) + 1) * 4;
+            ssize_t i_fci;
+
+            if ( i_len > i_size )
+                break;
+
+            if ( p_rtcp[1] == RTCP_PT_SR || p_rtcp[1] == RTCP_PT_RR )
+                output_RTCPReport( p_output, p_rtcp, i_len );
+
+            /* Generic NACK about our stream */
+            if ( p_rtcp[1] == RTCP_PT_RTPFB && (p_rtcp[0] & 0x1f) == 1
+                  && p_output->p_retx != NULL && i_len >= 12
+                  && !memcmp( p_rtcp + 8, p_output->config.pi_ssrc, 4 ) )
+            {
+                for ( i_fci = 12; i_fci + 4 <= i_len; i_fci += 4 )
+                {
+                    uint16_t i_pid = p_rtcp[i_fci] << 8 | p_rtcp[i_fci + 1];
+                    uint16_t i_blp = p_rtcp[i_fci + 2] << 8
+                                      | p_rtcp[i_fci + 3];
+                    int i;
+
+                    pi_seqnums[i_nb++] = i_pid;
+                    for ( i = 0; i < 16; i++ )
+                        if ( i_blp & (1 << i) )
+                            pi_seqnums[i_nb++] = i_pid + i + 1;
+                }
+            }
+
+            p_rtcp += i_len;
+            i_size -= i_len;
+        }
+
+        if ( !i_nb )
+            continue;
+
+        if ( p_output->p_worker != NULL )
+            pthread_mutex_lock( &p_output->p_worker->lock );
+        output_Retransmit( p_output, pi_seqnums, i_nb );
+        if ( p_output->p_worker != NULL )
+            pthread_mutex_unlock( &p_output->p_worker->lock );
+    }
+}
+
+/*****************************************************************************
+ * output_RTCPSend : send a sender report and the CNAME of an output
+ *****************************************************************************/
+static void output_RTCPSend( output_t *p_output )
+{
+    output_rtcp_t *p_rtcp_state = p_output->p_rtcp;
+    uint8_t p_rtcp[RTCP_MAX_SIZE];
+    uint64_t i_ntp = output_NTPDate();
+    uint32_t i_rtp = mdate() * 9 / 100; /* same clock as the RTP headers */
+    uint32_t i_packets = __atomic_load_n( &p_rtcp_state->i_packets,
+                                          __ATOMIC_RELAXED );
+    uint32_t i_octets = __atomic_load_n( &p_rtcp_state->i_octets,
+                                         __ATOMIC_RELAXED );
+    size_t i_cname = strlen( psz_rtcp_cname ), i_sdes;
+    socklen_t i_addr_len = p_output->config.i_family == AF_INET ?
+                           sizeof(struct sockaddr_in) :
+                           sizeof(struct sockaddr_in6);
+    int i;
+
+    if ( i_cname > 255 )
+        i_cname = 255;
+
+    /* SR without report blocks */
+    memset( p_rtcp, 0, sizeof(p_rtcp) );
+    p_rtcp[0] = 0x80;
+    p_rtcp[1] = RTCP_PT_SR;
+    p_rtcp[3] = 6;
+    memcpy( p_rtcp + 4, p_output->config.pi_ssrc, 4 );
+    for ( i = 0; i < 8; i++ )
+        p_rtcp[8 + i] = i_ntp >> (56 - 8 * i);
+    for ( i = 0; i < 4; i++ )
+    {
+        p_rtcp[16 + i] = i_rtp >> (24 - 8 * i);
+        p_rtcp[20 + i] = i_packets >> (24 - 8 * i);
+        p_rtcp[24 + i] = i_octets >> (24 - 8 * i);
+    }
+
+    /* SDES with one CNAME item, padded to 32 bits after the null item */
+    i_sdes = (4 + 4 + 2 + i_cname + 1 + 3) / 4 * 4;
+    p_rtcp[28] = 0x81;
+    p_rtcp[29] = RTCP_PT_SDES;
+    p_rtcp[31] = i_sdes / 4 - 1;
+    memcpy( p_rtcp + 32, p_output->config.pi_ssrc, 4 );
+    p_rtcp[36] = 1; /* CNAME */
+    p_rtcp[37] = i_cname;
+    memcpy( p_rtcp + 38, psz_rtcp_cname, i_cname );
+
+    if ( sendto( p_rtcp_state->i_handle, p_rtcp, 28 + i_sdes, 0,
+                 (struct sockaddr *)&p_rtcp_state->peer_addr,
+                 i_addr_len ) < 0 )
+        msg_Warn( NULL, "couldn't send RTCP to %s (%s)",
+                  p_output->config.psz_displayname, strerror(errno) );
+}
+
+/*****************************************************************************
+ * outputs_RTCPSend : periodic sender reports (main thread)
+ *****************************************************************************/
+static void outputs_RTCPSend( struct ev_loop *loop, struct ev_timer *w,
+                              int revents )
+{
+    int i;
+
+    for ( i = 0; i < i_nb_outputs; i++ )
+        if ( (pp_outputs[i]->config.i_config & OUTPUT_VALID)
+              && pp_outputs[i]->p_rtcp != NULL )
+            output_RTCPSend( pp_outputs[i] );
+    if ( (output_dup.config.i_config & OUTPUT_VALID)
+          && output_dup.p_rtcp != NULL )
+        output_RTCPSend( &output_dup );
+}
+
+/*****************************************************************************
+ * output_SetRTCP : open or close the RTCP socket of an output; it is bound
+ * to the source port of the output plus one (RFC 3550), where the receivers
+ * send their reports, and sends to the destination port plus one
+ *****************************************************************************/
+static void output_SetRTCP( output_t *p_output, bool b_rtcp )
+{
+    output_rtcp_t *p_rtcp = p_output->p_rtcp;
+    struct sockaddr_storage addr;
+    socklen_t i_len = sizeof(addr);
+
+    if ( !b_rtcp )
+    {
+        if ( p_rtcp == NULL )
+            return;
+        ev_io_stop( event_loop, &p_rtcp->watcher );
+        close( p_rtcp->i_handle );
+        free( p_rtcp );
+        p_output->p_rtcp = NULL;
+        return;
+    }
+
+    if ( p_rtcp != NULL )
+        return;
+
+    if ( getsockname( p_output->i_handle, (struct sockaddr *)&addr,
+                      &i_len ) < 0 )
+        goto error;
+    output_NextPort( &addr );
+
+    p_rtcp = calloc( 1, sizeof(output_rtcp_t) );
+    p_rtcp->p_output = p_output;
+    p_rtcp->i_rtt = -1;
+    p_rtcp->i_report_date = -1;
+    memcpy( &p_rtcp->peer_addr, &p_output->config.connect_addr,
+            sizeof(struct sockaddr_storage) );
+    output_NextPort( &p_rtcp->peer_addr );
+
+    if ( (p_rtcp->i_handle = socket( addr.ss_family, SOCK_DGRAM,
+                                     IPPROTO_UDP )) < 0 )
+    {
+        free( p_rtcp );
+        goto error;
+    }
+    if ( bind( p_rtcp->i_handle, (struct sockaddr *)&addr, i_len ) < 0 )
+    {
+        close( p_rtcp->i_handle );
+        free( p_rtcp );
+        goto error;
+    }
+
+    ev_io_init( &p_rtcp->watcher, output_RTCPRead, p_rtcp->i_handle, EV_READ );
+    p_rtcp->watcher.data = p_rtcp;
+    ev_io_start( event_loop, &p_rtcp->watcher );
+    p_output->p_rtcp = p_rtcp;
+    return;
+
+error:
+    msg_Warn( NULL, "%s: couldn't open the RTCP socket (%s)",
+              p_output->config.psz_displayname, strerror(errno) );
+}
+
+/*****************************************************************************
+ * output_SetRetx : start or stop the retransmission of an output, which
+ * requires its RTCP socket
+ *****************************************************************************/
+static void output_SetRetx( output_t *p_output, mtime_t i_retx )
+{
+    output_retx_t *p_retx = p_output->p_retx;
+
+    if ( !i_retx )
+    {
+        if ( p_retx == NULL )
+            return;
+        while ( p_retx->i_count )
+            output_HistoryDrop( p_output );
+        free( p_retx );
+        p_output->p_retx = NULL;
+        return;
+    }
+
+    if ( p_retx == NULL )
+    {
+        p_retx = p_output->p_retx = calloc( 1, sizeof(output_retx_t) );
+        p_retx->i_seqnum = rand() & 0xffff;
+    }
+
+    /* RTX stream multiplexed by SSRC (RFC 4588 section 8.3) */
+    memcpy( p_retx->pi_ssrc, p_output->config.pi_ssrc, 4 );
+    p_retx->pi_ssrc[3] ^= 1;
+}
+
+/*****************************************************************************
+ * output_Flush : send the packets due before i_date, OUTPUT_BATCH_MAX
+ * datagrams at a time
+ *****************************************************************************/
+static void output_Flush( output_t *p_output, mtime_t i_date )
+{
+    int i_block_cnt = output_BlockCount( p_output );
+    bool b_remap = b_do_remap || p_output->config.b_do_remap;
+    /* remapped packets take two entries, header and payload */
+    int i_stride = i_block_cnt * (b_remap ? 2 : 1)
+                    + ((p_output->config.i_config & OUTPUT_RAW) ? 1 : 0)
+                    + ((p_output->config.i_config & OUTPUT_UDP) ? 0 : 1);
+    uint16_t i_seg_size = i_block_cnt * TS_SIZE
+                    + ((p_output->config.i_config & OUTPUT_UDP) ?
+                       0 : RTP_HEADER_SIZE);
+    int i_segs = 1;
+    int64_t i_txtime_offset = 0;
+    packet_t *pp_packets[OUTPUT_BATCH_MAX];
+
+    output_Reserve( p_output, i_stride );
+
+    if ( p_output->b_gso )
+    {
+        i_segs = GSO_MAX_SIZE / i_seg_size;
+        if ( i_segs > UDP_MAX_SEGMENTS )
+            i_segs = UDP_MAX_SEGMENTS;
+        if ( i_segs * i_stride > IOV_MAX )
+            i_segs = IOV_MAX / i_stride;
+        if ( i_segs < 1 )
+            i_segs = 1;
+    }
+
+    if ( p_output->b_txtime )
+    {
+        /* Convert dates to the clock of the socket, in nanoseconds */
+        struct timespec ts;
+        clock_gettime( p_output->config.b_txtime_tai ? CLOCK_TAI
+                        : CLOCK_MONOTONIC, &ts );
+        i_txtime_offset = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec
+                           - mdate() * 1000;
+    }
+
+    while ( p_output->p_packets != NULL
+             && output_Due( p_output, p_output->p_packets ) <= i_date )
+    {
+        int i_packets, i_msgs, i_msg, i_block;
+
+        for ( i_packets = 0; i_packets < OUTPUT_BATCH_MAX
+                && p_output->p_packets != NULL
+                && output_Due( p_output, p_output->p_packets ) <= i_date;
+              i_packets++ )
+        {
+            packet_t *p_packet = p_output->p_packets;
+
+            p_output->p_packets = p_packet->p_next;
+            pp_packets[i_packets] = p_packet;
+            pi_send_txtimes[i_packets] = (p_packet->i_dts
+                    + p_output->config.i_output_latency) * 1000
+                    + i_txtime_offset;
+            output_FillMsg( p_output, p_packet, pp_rtp_hdrs[i_packets],
+                            p_send_iov + i_packets * i_stride,
+                            p_remap_hdrs + i_packets * i_block_cnt,
+                            p_copy_ts + i_packets * i_block_cnt,
+                            &p_raw6_hdrs[i_packets] );
+        }
+        if ( p_output->p_packets == NULL )
+            p_output->p_last_packet = NULL;
+
+        if ( p_output->p_record != NULL )
+            record_Write( p_output->p_record, p_send_iov,
+                          i_packets * i_stride );
+        else if ( p_output->p_stream != NULL )
+            http_StreamWrite( p_output->p_stream, p_send_iov,
+                              i_packets * i_stride );
+        else
+#ifdef HAVE_IO_URING
+        if ( p_output->i_uring_file >= 0 && !p_output->b_gso
+              && !p_output->b_txtime )
+            output_QueueMsgs( p_output, i_packets, i_stride );
+        else
+#endif
+        {
+            i_msgs = output_BuildMsgs( 0, i_packets, i_stride, i_segs,
+                                       i_seg_size, p_output->b_txtime );
+            i_msg = output_SendMsgs( p_output, i_msgs );
+            if ( i_msg < i_msgs && p_output->b_gso )
+            {
+                /* Fall back to one datagram per message */
+                msg_Warn( NULL, "couldn't use UDP GSO on %s (%s), disabling",
+                          p_output->config.psz_displayname, strerror(errno) );
+                p_output->b_gso = false;
+                i_msgs = output_BuildMsgs( i_msg * i_segs, i_packets,
+                                           i_stride, 1, i_seg_size,
+                                           p_output->b_txtime );
+                i_segs = 1;
+                output_SendMsgs( p_output, i_msgs );
+            }
+            /* Update the wallclock because sending can take some time. */
+            i_wallclock = mdate();
+        }
+
+        if ( p_output->p_rtcp != NULL )
+        {
+            __atomic_fetch_add( &p_output->p_rtcp->i_packets, i_packets,
+                                __ATOMIC_RELAXED );
+            __atomic_fetch_add( &p_output->p_rtcp->i_octets,
+                                (uint64_t)i_packets * i_block_cnt * TS_SIZE,
+                                __ATOMIC_RELAXED );
+        }
+
+        for ( i_msg = 0; i_msg < i_packets; i_msg++ )
+        {
+            packet_t *p_packet = pp_packets[i_msg];
+
+            if ( p_output->p_retx != NULL )
+            {
+                output_HistoryAdd( p_output, p_packet );
+                continue;
+            }
+            for ( i_block = 0; i_block < p_packet->i_depth; i_block++ )
+                output_BlockRelease( p_packet->pp_blocks[i_block] );
+            output_PacketDelete( p_output, p_packet );
+        }
+    }
+}
+
+/*****************************************************************************
+ * output_PacketAppend : append a new packet to the list of an output
+ *****************************************************************************/
+static packet_t *output_PacketAppend( output_t *p_output, mtime_t i_dts )
+{
+    packet_t *p_packet = output_PacketNew( p_output );
+
+    p_packet->i_dts = i_dts;
+    if ( p_output->p_last_packet != NULL )
+        p_output->p_last_packet->p_next = p_packet;
+    else
+        p_output->p_packets = p_packet;
+    p_output->p_last_packet = p_packet;
+    return p_packet;
+}
+
+/*****************************************************************************
+ * output_PacketizeCBR : append a block to the packets of a /cbr output; the
+ * packets are dated at a constant rate, and those left empty are sent as
+ * padding
+ *****************************************************************************/
+static packet_t *output_PacketizeCBR( output_t *p_output, block_t *p_block )
+{
+    int i_block_cnt = output_BlockCount( p_output );
+    uint64_t i_bits = (uint64_t)i_block_cnt * TS_SIZE * 8 * 1000000;
+    uint64_t i_cbr = p_output->config.i_cbr;
+    packet_t *p_packet = p_output->p_last_packet;
+
+    if ( p_output->i_cbr_date == -1
+          || p_block->i_dts - p_output->i_cbr_date
+              > p_output->config.i_output_latency )
+    {
+        /* Start the schedule, again after an input gap */
+        p_output->i_cbr_date = p_block->i_dts;
+        p_output->i_cbr_frac = 0;
+        p_output->b_cbr_overflow = false;
+        p_packet = NULL;
+    }
+    else if ( p_output->i_cbr_date - p_block->i_dts
+               > p_output->config.i_output_latency )
+    {
+        if ( !p_output->b_cbr_overflow )
+            msg_Warn( NULL, "%s exceeds its CBR bitrate, dropping packets",
+                      p_output->config.psz_displayname );
+        p_output->b_cbr_overflow = true;
+        output_BlockRelease( p_block );
+        return NULL;
+    }
+
+    /* First datagram with room which is not before the date of the block */
+    while ( p_packet == NULL || p_packet->i_depth == i_block_cnt
+             || p_packet->i_dts < p_block->i_dts )
+    {
+        if ( p_output->i_cbr_date <= p_block->i_dts )
+            p_output->b_cbr_overflow = false;
+
+        p_packet = output_PacketAppend( p_output, p_output->i_cbr_date );
+        p_output->i_cbr_date += i_bits / i_cbr;
+        p_output->i_cbr_frac += i_bits % i_cbr;
+        if ( p_output->i_cbr_frac >= i_cbr )
+        {
+            p_output->i_cbr_date++;
+            p_output->i_cbr_frac -= i_cbr;
+        }
+    }
+
+    p_packet->pp_blocks[p_packet->i_depth] = p_block;
+    p_packet->i_depth++;
+    return p_packet;
+}
+
+/*****************************************************************************
+ * output_Packetize : append a block to the packets of an output, returns
+ * NULL if it was dropped
+ *****************************************************************************/
+static packet_t *output_Packetize( output_t *p_output, block_t *p_block )
+{
+    int i_block_cnt = output_BlockCount( p_output );
+    packet_t *p_packet;
+
+    if ( p_output->config.i_cbr )
+        return output_PacketizeCBR( p_output, p_block );
 
     if ( p_output->p_last_packet != NULL
           && p_output->p_last_packet->i_depth < i_block_cnt
@@ -506,71 +1973,257 @@ void output_Put( output_t *p_output, block_t *p_block )
             p_packet->i_dts = p_block->i_dts;
     }
     else
-    {
-        p_packet = output_PacketNew( p_output );
-        p_packet->i_dts = p_block->i_dts;
-        if ( p_output->p_last_packet != NULL )
-            p_output->p_last_packet->p_next = p_packet;
-        else
-            p_output->p_packets = p_packet;
-        p_output->p_last_packet = p_packet;
-    }
+        p_packet = output_PacketAppend( p_output, p_block->i_dts );
 
     p_packet->pp_blocks[p_packet->i_depth] = p_block;
     p_packet->i_depth++;
+    return p_packet;
+}
 
-    if (i_next_send > p_packet->i_dts + p_output->config.i_output_latency)
+/*****************************************************************************
+ * output_Put : called from demux
+ *****************************************************************************/
+void output_Put( output_t *p_output, block_t *p_block )
+{
+    p_block->i_refcount++;
+
+    if ( p_output->p_worker != NULL )
     {
-        i_next_send = p_packet->i_dts + p_output->config.i_output_latency;
-        ev_timer_stop(event_loop, &output_watcher);
-        ev_timer_set(&output_watcher, (i_next_send - i_wallclock) / 1000000., 0);
-        ev_timer_start(event_loop, &output_watcher);
+        worker_Push( p_output->p_worker, p_output, p_block );
+        return;
     }
+
+    output_Packetize( p_output, p_block );
+    output_Queued( p_output );
+    outputs_Rearm();
 }
 
 /*****************************************************************************
- * outputs_Send :
+ * worker_Push : hand a block over to a sender thread (main thread)
  *****************************************************************************/
-static void outputs_Send(struct ev_loop *loop, struct ev_timer *w, int revents)
+static void worker_Push( output_worker_t *p_worker, output_t *p_output,
+                         block_t *p_block )
 {
-    i_wallclock = mdate();
+    unsigned int i_write = p_worker->i_entries_write;
+    unsigned int i_read = __atomic_load_n( &p_worker->i_entries_read,
+                                           __ATOMIC_ACQUIRE );
+    worker_entry_t *p_entry;
 
-    do
+    if ( i_write - i_read == WORKER_RING_SIZE )
     {
-        int i;
-        i_next_send = INT64_MAX;
+        if ( !p_worker->b_overrun )
+            msg_Warn( NULL, "sender thread is late, dropping packets" );
+        p_worker->b_overrun = true;
+        output_BlockRelease( p_block );
+        return;
+    }
+    p_worker->b_overrun = false;
+
+    p_entry = &p_worker->p_entries[i_write & (WORKER_RING_SIZE - 1)];
+    p_entry->p_output = p_output;
+    p_entry->p_block = p_block;
+    __atomic_store_n( &p_worker->i_entries_write, i_write + 1,
+                      __ATOMIC_RELEASE );
+    p_worker->b_pending = true;
+}
 
-        if ( output_dup.config.i_config & OUTPUT_VALID )
+/*****************************************************************************
+ * worker_Drain : packetize the blocks handed over to a sender thread (sender
+ * thread, or main thread with the outputs locked)
+ *****************************************************************************/
+static void worker_Drain( output_worker_t *p_worker )
+{
+    unsigned int i_read = p_worker->i_entries_read;
+    unsigned int i_write = __atomic_load_n( &p_worker->i_entries_write,
+                                            __ATOMIC_ACQUIRE );
+
+    while ( i_read != i_write )
+    {
+        worker_entry_t *p_entry =
+            &p_worker->p_entries[i_read & (WORKER_RING_SIZE - 1)];
+
+        if ( p_entry->p_output->config.i_config & OUTPUT_VALID )
         {
-            while ( output_dup.p_packets != NULL
-                     && output_dup.p_packets->i_dts
-                         + output_dup.config.i_output_latency <= i_wallclock )
-                output_Flush( &output_dup );
+            output_Packetize( p_entry->p_output, p_entry->p_block );
+            output_Queued( p_entry->p_output );
+        }
+        else
+            output_BlockRelease( p_entry->p_block );
+        i_read++;
+    }
+
+    __atomic_store_n( &p_worker->i_entries_read, i_read, __ATOMIC_RELEASE );
+}
+
+/*****************************************************************************
+ * worker_Send : send the due packets of a sender thread
+ *****************************************************************************/
+static void worker_Send( struct ev_loop *loop, output_worker_t *p_worker )
+{
+    output_heap_t *p_heap = &p_worker->heap;
+    mtime_t i_next = INT64_MAX;
+
+    pthread_mutex_lock( &p_worker->lock );
+    i_wallclock = mdate();
+    worker_Drain( p_worker );
+
+    while ( p_heap->i_nb_outputs
+             && p_heap->pp_outputs[0]->i_heap_date <= i_wallclock )
+    {
+        output_t *p_output = p_heap->pp_outputs[0];
+        output_Flush( p_output, i_wallclock );
+        output_Schedule( p_output );
+    }
+    if ( p_heap->i_nb_outputs )
+        i_next = p_heap->pp_outputs[0]->i_heap_date;
+
+    /* Move the blocks which didn't fit back to the ring */
+    while ( p_worker->i_nb_overflow )
+    {
+        unsigned int i_write = p_worker->i_returns_write;
+        if ( i_write - __atomic_load_n( &p_worker->i_returns_read,
+                                        __ATOMIC_ACQUIRE )
+               == WORKER_RING_SIZE )
+            break;
+        p_worker->pp_returns[i_write & (WORKER_RING_SIZE - 1)] =
+            p_worker->pp_overflow[--p_worker->i_nb_overflow];
+        __atomic_store_n( &p_worker->i_returns_write, i_write + 1,
+                          __ATOMIC_RELEASE );
+    }
+    pthread_mutex_unlock( &p_worker->lock );
+
+    ev_timer_stop( loop, &p_worker->send_watcher );
+    if ( i_next < INT64_MAX )
+    {
+        ev_timer_set( &p_worker->send_watcher,
+                      (i_next - i_wallclock) / 1000000., 0 );
+        ev_timer_start( loop, &p_worker->send_watcher );
+    }
+}
 
-            if ( output_dup.p_packets != NULL )
-                i_next_send = output_dup.p_packets->i_dts
-                                + output_dup.config.i_output_latency;
+static void worker_SendCb( struct ev_loop *loop, struct ev_timer *w,
+                           int revents )
+{
+    worker_Send( loop, ev_userdata( loop ) );
+}
+
+static void worker_WakeCb( struct ev_loop *loop, struct ev_async *w,
+                           int revents )
+{
+    output_worker_t *p_worker = ev_userdata( loop );
+
+    if ( __atomic_load_n( &p_worker->b_exit, __ATOMIC_ACQUIRE ) )
+    {
+        ev_break( loop, EVBREAK_ALL );
+        return;
+    }
+    worker_Send( loop, p_worker );
+}
+
+/*****************************************************************************
+ * worker_Thread
+ *****************************************************************************/
+static void *worker_Thread( void *p_data )
+{
+    output_worker_t *p_worker = p_data;
+
+    p_current_worker = p_worker;
+    ev_run( p_worker->p_loop, 0 );
+
+    free( p_send_iov );
+    free( p_remap_hdrs );
+    free( p_copy_ts );
+    return NULL;
+}
+
+/*****************************************************************************
+ * outputs_Wake : release the blocks sent by the sender threads, and wake
+ * them up if they have new blocks (main thread)
+ *****************************************************************************/
+void outputs_Wake( void )
+{
+    int i;
+
+    for ( i = 0; i < i_output_threads; i++ )
+    {
+        output_worker_t *p_worker = &p_workers[i];
+        unsigned int i_read = p_worker->i_returns_read;
+        unsigned int i_write = __atomic_load_n( &p_worker->i_returns_write,
+                                                __ATOMIC_ACQUIRE );
+
+        while ( i_read != i_write )
+        {
+            block_t *p_block =
+                p_worker->pp_returns[i_read++ & (WORKER_RING_SIZE - 1)];
+            p_block->i_refcount--;
+            if ( !p_block->i_refcount )
+                block_Delete( p_block );
         }
+        __atomic_store_n( &p_worker->i_returns_read, i_read,
+                          __ATOMIC_RELEASE );
 
-        for ( i = 0; i < i_nb_outputs; i++ )
+        if ( p_worker->b_pending )
         {
-            output_t *p_output = pp_outputs[i];
-            if ( !( p_output->config.i_config & OUTPUT_VALID ) )
-                continue;
+            p_worker->b_pending = false;
+            ev_async_send( p_worker->p_loop, &p_worker->wake_watcher );
+        }
+    }
+}
 
-            while ( p_output->p_packets != NULL
-                     && p_output->p_packets->i_dts
-                         + p_output->config.i_output_latency <= i_wallclock )
-                output_Flush( p_output );
+/*****************************************************************************
+ * outputs_Lock : stop the sender threads before changing the outputs
+ * (main thread, may be nested)
+ *****************************************************************************/
+void outputs_Lock( void )
+{
+    int i;
 
-            if ( p_output->p_packets != NULL
-                  && (p_output->p_packets->i_dts
-                       + p_output->config.i_output_latency < i_next_send) )
-                i_next_send = p_output->p_packets->i_dts
-                                  + p_output->config.i_output_latency;
-        }
+    if ( i_outputs_locked++ )
+        return;
+
+    for ( i = 0; i < i_output_threads; i++ )
+    {
+        pthread_mutex_lock( &p_workers[i].lock );
+        worker_Drain( &p_workers[i] );
+    }
+}
+
+/*****************************************************************************
+ * outputs_Unlock
+ *****************************************************************************/
+void outputs_Unlock( void )
+{
+    int i;
+
+    if ( --i_outputs_locked )
+        return;
+
+    for ( i = 0; i < i_output_threads; i++ )
+    {
+        pthread_mutex_unlock( &p_workers[i].lock );
+        p_workers[i].b_pending = true;
+    }
+    outputs_Wake();
+}
+
+/*****************************************************************************
+ * outputs_Send :
+ *****************************************************************************/
+static void outputs_Send(struct ev_loop *loop, struct ev_timer *w, int revents)
+{
+    i_wallclock = mdate();
+    i_next_send = INT64_MAX;
+
+    /* Only the outputs which are due are visited */
+    while ( output_heap.i_nb_outputs
+             && output_heap.pp_outputs[0]->i_heap_date <= i_wallclock )
+    {
+        output_t *p_output = output_heap.pp_outputs[0];
+        output_Flush( p_output, i_wallclock );
+        output_Schedule( p_output );
     }
-    while (i_next_send <= i_wallclock);
+    if ( output_heap.i_nb_outputs )
+        i_next_send = output_heap.pp_outputs[0]->i_heap_date;
 
     if (i_next_send < INT64_MAX)
     {
@@ -584,7 +2237,130 @@ static void outputs_Send(struct ev_loop *loop, struct ev_timer *w, int revents)
  *****************************************************************************/
 void outputs_Init( void )
 {
+    int i;
+
     ev_timer_init(&output_watcher, outputs_Send, 0, 0);
+
+    /* Sender threads allocate and free packets */
+    p_packet_pool = pool_New( sizeof(packet_t)
+                                + PACKET_POOL_BLOCKS * sizeof(block_t *),
+                              i_pool_size / 2, b_pool_hugepages,
+                              i_output_threads > 0 );
+
+    strcpy( psz_rtcp_cname, "dvblast@" );
+    gethostname( psz_rtcp_cname + 8, sizeof(psz_rtcp_cname) - 9 );
+    psz_rtcp_cname[sizeof(psz_rtcp_cname) - 1] = '\0';
+    ev_timer_init( &rtcp_watcher, outputs_RTCPSend, RTCP_PERIOD, RTCP_PERIOD );
+    ev_timer_start( event_loop, &rtcp_watcher );
+
+    if ( !i_output_threads )
+        return;
+
+#ifdef HAVE_IO_URING
+    if ( b_io_uring )
+    {
+        msg_Warn( NULL, "io_uring is not available with sender threads, using writev" );
+        b_io_uring = false;
+    }
+#endif
+
+    p_workers = calloc( i_output_threads, sizeof(output_worker_t) );
+    for ( i = 0; i < i_output_threads; i++ )
+    {
+        output_worker_t *p_worker = &p_workers[i];
+
+        pthread_mutex_init( &p_worker->lock, NULL );
+        p_worker->p_entries = malloc( WORKER_RING_SIZE
+                                       * sizeof(worker_entry_t) );
+        p_worker->pp_returns = malloc( WORKER_RING_SIZE
+                                        * sizeof(block_t *) );
+        p_worker->p_loop = ev_loop_new( EVFLAG_AUTO );
+        if ( p_worker->p_loop == NULL )
+        {
+            msg_Err( NULL, "unable to initialize libev for sender thread" );
+            exit(EXIT_FAILURE);
+        }
+        ev_set_userdata( p_worker->p_loop, p_worker );
+        ev_timer_init( &p_worker->send_watcher, worker_SendCb, 0, 0 );
+        ev_async_init( &p_worker->wake_watcher, worker_WakeCb );
+        ev_async_start( p_worker->p_loop, &p_worker->wake_watcher );
+
+        if ( pthread_create( &p_worker->thread, NULL, worker_Thread,
+                             p_worker ) )
+        {
+            msg_Err( NULL, "couldn't create sender thread" );
+            exit(EXIT_FAILURE);
+        }
+    }
+    msg_Dbg( NULL, "started %d sender threads", i_output_threads );
+}
+
+/*****************************************************************************
+ * outputs_Status : batching statistics for dvblastctl
+ *****************************************************************************/
+uint8_t outputs_Status( uint8_t *p_answer, ssize_t *pi_size )
+{
+    struct ret_output_status *p_ret = (struct ret_output_status *)p_answer;
+
+    memset( p_ret, 0, sizeof(struct ret_output_status) );
+    p_ret->i_max_batch = i_send_max_batch;
+    p_ret->i_syscalls = i_send_syscalls;
+    p_ret->i_datagrams = i_send_datagrams;
+    memcpy( p_ret->pi_histogram, pi_send_histogram,
+            sizeof(pi_send_histogram) );
+
+    *pi_size = sizeof(struct ret_output_status);
+    return RET_OUTPUT_STATUS;
+}
+
+/*****************************************************************************
+ * outputs_PoolStatus : statistics of the packet pool for dvblastctl
+ *****************************************************************************/
+void outputs_PoolStatus( struct ret_pool *p_ret )
+{
+    pool_Status( p_packet_pool, p_ret );
+}
+
+/*****************************************************************************
+ * outputs_RTCPStatus : RTCP statistics of the outputs for dvblastctl
+ *****************************************************************************/
+uint8_t outputs_RTCPStatus( uint8_t *p_answer, ssize_t *pi_size )
+{
+    struct ret_rtcp_status *p_ret = (struct ret_rtcp_status *)p_answer;
+    int i;
+
+    p_ret->i_nb_outputs = 0;
+    for ( i = 0; i < i_nb_outputs
+                  && p_ret->i_nb_outputs < RTCP_STATUS_MAX_OUTPUTS; i++ )
+    {
+        output_t *p_output = pp_outputs[i];
+        output_rtcp_t *p_rtcp = p_output->p_rtcp;
+        struct ret_rtcp_output *p_entry;
+
+        if ( !(p_output->config.i_config & OUTPUT_VALID) || p_rtcp == NULL )
+            continue;
+
+        p_entry = &p_ret->p_outputs[p_ret->i_nb_outputs++];
+        memset( p_entry, 0, sizeof(struct ret_rtcp_output) );
+        strncpy( p_entry->psz_name, p_output->config.psz_displayname,
+                 sizeof(p_entry->psz_name) - 1 );
+        p_entry->i_packets = __atomic_load_n( &p_rtcp->i_packets,
+                                              __ATOMIC_RELAXED );
+        p_entry->i_octets = __atomic_load_n( &p_rtcp->i_octets,
+                                             __ATOMIC_RELAXED );
+        p_entry->i_retransmitted = p_rtcp->i_retransmitted;
+        p_entry->i_reports = p_rtcp->i_reports;
+        p_entry->i_report_age = p_rtcp->i_report_date == -1 ? -1 :
+                                mdate() - p_rtcp->i_report_date;
+        p_entry->i_fraction_lost = p_rtcp->i_fraction_lost;
+        p_entry->i_cumulative_lost = p_rtcp->i_cumulative_lost;
+        p_entry->i_jitter = p_rtcp->i_jitter;
+        p_entry->i_rtt = p_rtcp->i_rtt;
+    }
+
+    *pi_size = sizeof(struct ret_rtcp_status)
+                + p_ret->i_nb_outputs * sizeof(struct ret_rtcp_output);
+    return RET_RTCP_STATUS;
 }
 
 /*****************************************************************************
@@ -603,6 +2379,16 @@ output_t *output_Find( const output_config_t *p_config )
 
         if ( !(p_output->config.i_config & OUTPUT_VALID) ) continue;
 
+        if ( (p_config->i_config ^ p_output->config.i_config)
+               & (OUTPUT_FILE | OUTPUT_HTTP) )
+            continue;
+        if ( p_config->i_config & (OUTPUT_FILE | OUTPUT_HTTP) )
+        {
+            if ( strcmp( p_config->psz_path, p_output->config.psz_path ) )
+                continue;
+            return p_output;
+        }
+
         if ( p_config->i_family != p_output->config.i_family ||
              memcmp( &p_config->connect_addr, &p_output->config.connect_addr,
                      i_sockaddr_len ) ||
@@ -630,6 +2416,7 @@ output_t *output_Find( const output_config_t *p_config )
 void output_Change( output_t *p_output, const output_config_t *p_config )
 {
     int ret = 0;
+    bool b_rtcp;
     memcpy( p_output->config.pi_ssrc, p_config->pi_ssrc, 4 * sizeof(uint8_t) );
     p_output->config.i_output_latency = p_config->i_output_latency;
     p_output->config.i_max_retention = p_config->i_max_retention;
@@ -656,6 +2443,7 @@ void output_Change( output_t *p_output, const output_config_t *p_config )
         }
         p_output->config.i_ttl = p_config->i_ttl;
         p_output->raw_pkt_header.iph.ttl = p_config->i_ttl;
+        p_output->raw6_pkt_header.ip6h.ip6_hlim = p_config->i_ttl;
     }
 
     if ( p_output->config.i_tos != p_config->i_tos )
@@ -666,6 +2454,8 @@ void output_Change( output_t *p_output, const output_config_t *p_config )
                               sizeof(p_config->i_tos) );
         p_output->config.i_tos = p_config->i_tos;
         p_output->raw_pkt_header.iph.tos = p_config->i_tos;
+        p_output->raw6_pkt_header.ip6h.ip6_flow =
+            htonl( (6 << 28) | (p_config->i_tos << 20) );
     }
 
     if (ret == -1)
@@ -680,21 +2470,83 @@ void output_Change( output_t *p_output, const output_config_t *p_config )
         p_output->config.i_config |= p_config->i_config & OUTPUT_UDP;
         p_output->config.i_mtu = p_config->i_mtu;
 
+        /* The history has packets of the former size */
+        while ( p_output->p_retx != NULL && p_output->p_retx->i_count )
+            output_HistoryDrop( p_output );
         output_PacketVacuum( p_output );
 
         i_block_cnt = output_BlockCount( p_output );
         if ( p_packet != NULL && p_packet->i_depth < i_block_cnt )
         {
-            p_packet = realloc( p_packet, sizeof(packet_t *)
-                                 + i_block_cnt * sizeof(block_t *) );
-            p_output->p_last_packet = p_packet;
+            /* Move the last packet to a slot of the new size */
+            packet_t *p_new = output_PacketNew( p_output );
+            packet_t **pp_packet = &p_output->p_packets;
+
+            memcpy( p_new, p_packet, sizeof(packet_t)
+                     + p_packet->i_depth * sizeof(block_t *) );
+            while ( *pp_packet != p_packet )
+                pp_packet = &(*pp_packet)->p_next;
+            *pp_packet = p_new;
+            p_output->p_last_packet = p_new;
+            pool_Free( p_packet_pool, p_packet );
         }
     }
 
-    if ( p_config->i_config & OUTPUT_RAW ) {
+    if ( p_output->p_record != NULL )
+        record_Change( p_output->p_record, p_config );
+
+    b_rtcp = (p_config->i_config & OUTPUT_RTCP) || p_config->i_retx;
+    if ( b_rtcp && (p_output->config.i_config
+                     & (OUTPUT_UDP | OUTPUT_RAW | OUTPUT_FILE | OUTPUT_HTTP)) )
+    {
+        if ( ((p_output->config.i_config ^ p_config->i_config) & OUTPUT_RTCP)
+              || p_output->config.i_retx != p_config->i_retx )
+            msg_Warn( NULL, "%s: /rtcp and /retx require an RTP output",
+                      p_output->config.psz_displayname );
+        b_rtcp = false;
+    }
+    p_output->config.i_config &= ~OUTPUT_RTCP;
+    p_output->config.i_config |= p_config->i_config & OUTPUT_RTCP;
+    p_output->config.i_retx = p_config->i_retx;
+    output_SetRTCP( p_output, b_rtcp );
+    output_SetRetx( p_output, p_output->p_rtcp != NULL ? p_config->i_retx : 0 );
+
+    if ( p_output->config.i_cbr != p_config->i_cbr )
+    {
+        p_output->config.i_cbr = p_config->i_cbr;
+        p_output->i_cbr_date = -1;
+    }
+
+    p_output->b_gso = (p_config->i_config & OUTPUT_GSO)
+                       && output_CheckGSO( p_output );
+
+    if ( (p_config->i_config & OUTPUT_TXTIME)
+          && (!p_output->b_txtime
+               || p_output->config.b_txtime_tai != p_config->b_txtime_tai) )
+    {
+        p_output->config.b_txtime_tai = p_config->b_txtime_tai;
+        p_output->b_txtime = output_SetTxtime( p_output,
+                                               p_config->b_txtime_tai );
+    }
+    else if ( !(p_config->i_config & OUTPUT_TXTIME) )
+        p_output->b_txtime = false;
+
+    if ( (p_config->i_config & OUTPUT_RAW)
+          && p_output->config.i_family == AF_INET6 )
+        Raw6FillHeaders( p_output, p_config->psz_srcaddr, p_config->i_srcport,
+                         p_output->config.i_ttl, p_output->config.i_tos );
+    else if ( p_config->i_config & OUTPUT_RAW ) {
         p_output->raw_pkt_header.iph.saddr = inet_addr(p_config->psz_srcaddr);
         p_output->raw_pkt_header.udph.source = htons(p_config->i_srcport);
     }
+
+    /* The latency may have changed */
+    if ( p_output->i_heap_index >= 0 )
+    {
+        output_Schedule( p_output );
+        if ( p_output->p_worker == NULL )
+            outputs_Rearm();
+    }
 }
 
 /*****************************************************************************
@@ -704,6 +2556,23 @@ void outputs_Close( int i_num_outputs )
 {
     int i;
 
+    for ( i = 0; i < i_output_threads; i++ )
+    {
+        output_worker_t *p_worker = &p_workers[i];
+
+        __atomic_store_n( &p_worker->b_exit, true, __ATOMIC_RELEASE );
+        ev_async_send( p_worker->p_loop, &p_worker->wake_watcher );
+        pthread_join( p_worker->thread, NULL );
+        p_worker->b_pending = false;
+
+        /* The remaining blocks are now handled by the main thread */
+        worker_Drain( p_worker );
+        for ( ; p_worker->i_nb_overflow; p_worker->i_nb_overflow-- )
+            output_BlockRelease(
+                p_worker->pp_overflow[p_worker->i_nb_overflow - 1] );
+    }
+    outputs_Wake();
+
     for ( i = 0; i < i_num_outputs; i++ )
     {
         output_t *p_output = pp_outputs[i];
@@ -712,8 +2581,7 @@ void outputs_Close( int i_num_outputs )
         {
             msg_Dbg( NULL, "removing %s", p_output->config.psz_displayname );
 
-            if ( p_output->p_packets )
-                output_Flush( p_output );
+            output_Flush( p_output, INT64_MAX );
             output_Close( p_output );
         }
 
@@ -721,4 +2589,34 @@ void outputs_Close( int i_num_outputs )
     }
 
     free( pp_outputs );
+    ev_timer_stop( event_loop, &rtcp_watcher );
+#ifdef HAVE_IO_URING
+    uring_Close();
+#endif
+    for ( i = 0; i < i_output_threads; i++ )
+    {
+        ev_loop_destroy( p_workers[i].p_loop );
+        pthread_mutex_destroy( &p_workers[i].lock );
+        free( p_workers[i].p_entries );
+        free( p_workers[i].pp_returns );
+        free( p_workers[i].pp_overflow );
+        free( p_workers[i].pp_outputs );
+        free( p_workers[i].heap.pp_outputs );
+    }
+    free( p_workers );
+    p_workers = NULL;
+    free( output_heap.pp_outputs );
+    output_heap.pp_outputs = NULL;
+    output_heap.i_nb_outputs = output_heap.i_max_outputs = 0;
+    free( p_remap_hdrs );
+    p_remap_hdrs = NULL;
+    i_remap_size = 0;
+    free( p_copy_ts );
+    p_copy_ts = NULL;
+    i_copy_size = 0;
+    free( p_send_iov );
+    p_send_iov = NULL;
+    i_send_iov_size = 0;
+    pool_Delete( p_packet_pool );
+    p_packet_pool = NULL;
 }
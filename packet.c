@@ -0,0 +1,448 @@
+/*****************************************************************************
+ * packet.c: AF_PACKET memory-mapped ring input for DVBlast
+ *****************************************************************************
+ * Copyright (C) 2026 VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+#include "config.h"
+
+#ifdef HAVE_PACKET_MMAP
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <net/ethernet.h>
+#include <linux/if_packet.h>
+#include <linux/filter.h>
+#include <errno.h>
+
+#include <ev.h>
+
+#include <bitstream/common.h>
+#include <bitstream/ietf/rtp.h>
+
+#include "dvblast.h"
+#include "en50221.h"
+#include "comm.h"
+
+/*****************************************************************************
+ * Local declarations
+ *****************************************************************************/
+#define PACKET_BLOCK_SIZE (1 << 20) /* 1 MB */
+#define PACKET_FRAME_SIZE 2048
+#define PACKET_BLOCK_TIMEOUT 10 /* ms */
+#define DEFAULT_PACKET_BLOCKS 64
+
+static int i_handle = -1;
+static int i_join_handle = -1;
+static struct ev_io packet_watcher;
+static struct ev_timer mute_watcher;
+static uint8_t *p_ring = NULL;
+static unsigned int i_nb_blocks = DEFAULT_PACKET_BLOCKS;
+static unsigned int i_current_block = 0;
+static bool b_udp = false;
+static bool b_sync = false;
+static bool b_seqnum = false;
+static uint16_t i_next_seqnum;
+static uint64_t i_nb_datagrams = 0, i_nb_lost = 0, i_nb_dropped = 0;
+
+/*****************************************************************************
+ * Local prototypes
+ *****************************************************************************/
+static void packet_Read(struct ev_loop *loop, struct ev_io *w, int revents);
+static void packet_MuteCb(struct ev_loop *loop, struct ev_timer *w, int revents);
+static void packet_AttachFilter( in_addr_t i_addr, in_port_t i_port );
+static block_t **packet_HandleFrame( const uint8_t *p_frame,
+                                     unsigned int i_len,
+                                     block_t **pp_current );
+
+/*****************************************************************************
+ * packet_Open
+ *****************************************************************************/
+void packet_Open( void )
+{
+    struct addrinfo *p_ai;
+    struct sockaddr_in *p_addr;
+    struct sockaddr_ll sll;
+    struct tpacket_req3 req;
+    char *psz_string = strdup( psz_packet_src );
+    char *psz_save = psz_string;
+    char *psz_ifname = NULL;
+    unsigned int i_if_index = 0;
+    int i = TPACKET_V3;
+
+    /* Parse configuration. */
+
+    p_ai = ParseNodeService( psz_string, &psz_string, DEFAULT_PORT );
+    if ( p_ai == NULL )
+    {
+        msg_Err( NULL, "couldn't parse %s", psz_save );
+        exit(EXIT_FAILURE);
+    }
+    if ( p_ai->ai_family != AF_INET )
+    {
+        msg_Err( NULL, "packet input currently implemented for ipv4 only" );
+        exit(EXIT_FAILURE);
+    }
+    p_addr = (struct sockaddr_in *)p_ai->ai_addr;
+
+    while ( (psz_string = strchr( psz_string, '/' )) != NULL )
+    {
+        *psz_string++ = '\0';
+
+#define IS_OPTION( option ) (!strncasecmp( psz_string, option, strlen(option) ))
+#define ARG_OPTION( option ) (psz_string + strlen(option))
+
+        if ( IS_OPTION("udp") )
+            b_udp = true;
+        else if ( IS_OPTION("ifname=") )
+        {
+            free( psz_ifname );
+            psz_ifname = config_stropt( ARG_OPTION("ifname=") );
+        }
+        else if ( IS_OPTION("blocks=") )
+            i_nb_blocks = strtoul( ARG_OPTION("blocks="), NULL, 0 );
+        else
+            msg_Warn( NULL, "unrecognized option %s", psz_string );
+
+#undef IS_OPTION
+#undef ARG_OPTION
+    }
+
+    if ( psz_ifname == NULL ||
+         (i_if_index = if_nametoindex( psz_ifname )) == 0 )
+    {
+        msg_Err( NULL, "packet input needs a valid /ifname= option" );
+        exit(EXIT_FAILURE);
+    }
+    if ( !i_nb_blocks )
+        i_nb_blocks = DEFAULT_PACKET_BLOCKS;
+
+    /* Do stuff. */
+
+    if ( (i_handle = socket( AF_PACKET, SOCK_RAW, htons(ETH_P_IP) )) < 0 )
+    {
+        msg_Err( NULL, "couldn't create packet socket (%s)", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+
+    /* Filter before binding so that no foreign frame reaches the ring */
+    packet_AttachFilter( p_addr->sin_addr.s_addr, p_addr->sin_port );
+
+    if ( setsockopt( i_handle, SOL_PACKET, PACKET_VERSION, &i,
+                     sizeof(i) ) < 0 )
+    {
+        msg_Err( NULL, "couldn't select TPACKET_V3 (%s)", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+
+    memset( &req, 0, sizeof(req) );
+    req.tp_block_size = PACKET_BLOCK_SIZE;
+    req.tp_block_nr = i_nb_blocks;
+    req.tp_frame_size = PACKET_FRAME_SIZE;
+    req.tp_frame_nr = PACKET_BLOCK_SIZE / PACKET_FRAME_SIZE * i_nb_blocks;
+    req.tp_retire_blk_tov = PACKET_BLOCK_TIMEOUT;
+    if ( setsockopt( i_handle, SOL_PACKET, PACKET_RX_RING, &req,
+                     sizeof(req) ) < 0 )
+    {
+        msg_Err( NULL, "couldn't set up packet ring (%s)", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+
+    p_ring = mmap( NULL, (size_t)PACKET_BLOCK_SIZE * i_nb_blocks,
+                   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED,
+                   i_handle, 0 );
+    if ( p_ring == MAP_FAILED )
+    {
+        msg_Err( NULL, "couldn't map packet ring (%s)", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+
+    memset( &sll, 0, sizeof(sll) );
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_IP);
+    sll.sll_ifindex = i_if_index;
+    if ( bind( i_handle, (struct sockaddr *)&sll, sizeof(sll) ) < 0 )
+    {
+        msg_Err( NULL, "couldn't bind to %s (%s)", psz_ifname,
+                 strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+
+    /* The packet socket doesn't send IGMP, keep a UDP socket for that */
+    if ( IN_MULTICAST( ntohl(p_addr->sin_addr.s_addr) ) )
+    {
+        struct ip_mreqn imr;
+        memset( &imr, 0, sizeof(imr) );
+        imr.imr_multiaddr = p_addr->sin_addr;
+        imr.imr_ifindex = i_if_index;
+
+        if ( (i_join_handle = socket( AF_INET, SOCK_DGRAM, IPPROTO_UDP )) < 0
+              || setsockopt( i_join_handle, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+                             (char *)&imr, sizeof(struct ip_mreqn) ) < 0 )
+            msg_Warn( NULL, "couldn't join multicast group (%s)",
+                      strerror(errno) );
+    }
+
+    msg_Dbg( NULL, "receiving %s on %s with a %u MB ring", psz_packet_src,
+             psz_ifname, i_nb_blocks * (PACKET_BLOCK_SIZE >> 20) );
+
+    freeaddrinfo( p_ai );
+    free( psz_ifname );
+    free( psz_save );
+
+    ev_io_init(&packet_watcher, packet_Read, i_handle, EV_READ);
+    ev_io_start(event_loop, &packet_watcher);
+
+    ev_timer_init(&mute_watcher, packet_MuteCb,
+                  i_udp_lock_timeout / 1000000., i_udp_lock_timeout / 1000000.);
+}
+
+/*****************************************************************************
+ * packet_AttachFilter: only accepts unfragmented UDP to the given address
+ * and port (both in network byte order)
+ *****************************************************************************/
+static void packet_AttachFilter( in_addr_t i_addr, in_port_t i_port )
+{
+    struct sock_filter p_code[] = {
+        BPF_STMT(BPF_LD + BPF_H + BPF_ABS, 12),          /* ethertype */
+        BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ETH_P_IP, 0, 10),
+        BPF_STMT(BPF_LD + BPF_B + BPF_ABS, 23),          /* IP protocol */
+        BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, IPPROTO_UDP, 0, 8),
+        BPF_STMT(BPF_LD + BPF_W + BPF_ABS, 30),          /* IP destination */
+        BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ntohl(i_addr), 0, 6),
+        BPF_STMT(BPF_LD + BPF_H + BPF_ABS, 20),          /* fragment offset */
+        BPF_JUMP(BPF_JMP + BPF_JSET + BPF_K, 0x1fff, 4, 0),
+        BPF_STMT(BPF_LDX + BPF_B + BPF_MSH, 14),         /* IP header length */
+        BPF_STMT(BPF_LD + BPF_H + BPF_IND, 16),          /* UDP destination */
+        BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ntohs(i_port), 0, 1),
+        BPF_STMT(BPF_RET + BPF_K, 0xffff),
+        BPF_STMT(BPF_RET + BPF_K, 0),
+    };
+    struct sock_fprog prog = {
+        .len = sizeof(p_code) / sizeof(p_code[0]),
+        .filter = p_code,
+    };
+
+    if ( setsockopt( i_handle, SOL_SOCKET, SO_ATTACH_FILTER, &prog,
+                     sizeof(prog) ) < 0 )
+    {
+        msg_Err( NULL, "couldn't attach packet filter (%s)", strerror(errno) );
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*****************************************************************************
+ * Packet events
+ *****************************************************************************/
+static void packet_Read(struct ev_loop *loop, struct ev_io *w, int revents)
+{
+    block_t *p_ts = NULL, **pp_current = &p_ts;
+
+    i_wallclock = mdate();
+
+    for ( ; ; )
+    {
+        struct tpacket_block_desc *p_desc = (struct tpacket_block_desc *)
+            (p_ring + (size_t)i_current_block * PACKET_BLOCK_SIZE);
+        struct tpacket3_hdr *p_hdr;
+        unsigned int i;
+
+        if ( !(p_desc->hdr.bh1.block_status & TP_STATUS_USER) )
+            break;
+
+        p_hdr = (struct tpacket3_hdr *)
+            ((uint8_t *)p_desc + p_desc->hdr.bh1.offset_to_first_pkt);
+        for ( i = 0; i < p_desc->hdr.bh1.num_pkts; i++ )
+        {
+            pp_current = packet_HandleFrame( (uint8_t *)p_hdr + p_hdr->tp_mac,
+                                             p_hdr->tp_snaplen, pp_current );
+            p_hdr = (struct tpacket3_hdr *)
+                ((uint8_t *)p_hdr + p_hdr->tp_next_offset);
+        }
+
+        /* Give the block back to the kernel */
+        __sync_synchronize();
+        p_desc->hdr.bh1.block_status = TP_STATUS_KERNEL;
+        i_current_block = (i_current_block + 1) % i_nb_blocks;
+    }
+    *pp_current = NULL;
+
+    if ( p_ts != NULL )
+    {
+        if ( !b_sync )
+        {
+            msg_Info( NULL, "frontend has acquired lock" );
+            switch (i_print_type) {
+            case PRINT_XML:
+                fprintf(print_fh, "<STATUS type=\"lock\" status=\"1\"/>\n");
+                break;
+            case PRINT_TEXT:
+                fprintf(print_fh, "lock status: 1\n");
+                break;
+            default:
+                break;
+            }
+
+            b_sync = true;
+        }
+
+        ev_timer_again(loop, &mute_watcher);
+    }
+
+    demux_Run( p_ts );
+}
+
+/*****************************************************************************
+ * packet_HandleFrame: copies the TS packets of an Ethernet frame into blocks
+ *****************************************************************************/
+static block_t **packet_HandleFrame( const uint8_t *p_frame,
+                                     unsigned int i_len,
+                                     block_t **pp_current )
+{
+    const uint8_t *p_ip = p_frame + ETH_HLEN;
+    const uint8_t *p_payload;
+    unsigned int i_ip_len, i_udp_len;
+
+    if ( i_len < ETH_HLEN + 20 + 8 || p_ip[9] != IPPROTO_UDP )
+        return pp_current;
+    i_ip_len = (p_ip[0] & 0xf) * 4;
+    if ( i_ip_len < 20 || ETH_HLEN + i_ip_len + 8 > i_len )
+        return pp_current;
+    i_udp_len = (p_ip[i_ip_len + 4] << 8) | p_ip[i_ip_len + 5];
+    if ( i_udp_len < 8 || ETH_HLEN + i_ip_len + i_udp_len > i_len )
+        return pp_current;
+
+    p_payload = p_ip + i_ip_len + 8;
+    i_len = i_udp_len - 8;
+    i_nb_datagrams++;
+
+    if ( !b_udp )
+    {
+        unsigned int i_hdr_len;
+        uint16_t i_seqnum;
+
+        if ( i_len < RTP_HEADER_SIZE || !rtp_check_hdr( p_payload ) )
+        {
+            msg_Warn( NULL, "invalid RTP packet received" );
+            return pp_current;
+        }
+
+        i_seqnum = rtp_get_seqnum( p_payload );
+        if ( b_seqnum && i_seqnum != i_next_seqnum )
+        {
+            int16_t i_gap = i_seqnum - i_next_seqnum;
+            msg_Warn( NULL, "RTP discontinuity" );
+            if ( i_gap > 0 )
+                i_nb_lost += i_gap;
+        }
+        i_next_seqnum = i_seqnum + 1;
+        b_seqnum = true;
+
+        /* Skip CSRCs and header extension */
+        i_hdr_len = RTP_HEADER_SIZE + 4 * (p_payload[0] & 0xf);
+        if ( (p_payload[0] & 0x10) && i_hdr_len + 4 <= i_len )
+            i_hdr_len += 4 + 4 * ((p_payload[i_hdr_len + 2] << 8) |
+                                  p_payload[i_hdr_len + 3]);
+        if ( i_hdr_len > i_len )
+            return pp_current;
+
+        p_payload += i_hdr_len;
+        i_len -= i_hdr_len;
+    }
+
+    return tssync_RunBuffer( p_payload, i_len, false, pp_current );
+}
+
+static void packet_MuteCb(struct ev_loop *loop, struct ev_timer *w, int revents)
+{
+    msg_Warn( NULL, "frontend has lost lock" );
+    ev_timer_stop(loop, w);
+
+    switch (i_print_type) {
+    case PRINT_XML:
+        fprintf(print_fh, "<STATUS type=\"lock\" status=\"0\"/>\n");
+        break;
+    case PRINT_TEXT:
+        fprintf(print_fh, "lock status: 0\n" );
+        break;
+    default:
+        break;
+    }
+
+    b_sync = false;
+}
+
+/* From now on these are just stubs */
+
+/*****************************************************************************
+ * packet_SetFilter
+ *****************************************************************************/
+int packet_SetFilter( uint16_t i_pid )
+{
+    return -1;
+}
+
+/*****************************************************************************
+ * packet_UnsetFilter: normally never called
+ *****************************************************************************/
+void packet_UnsetFilter( int i_fd, uint16_t i_pid )
+{
+}
+
+/*****************************************************************************
+ * packet_Reset:
+ *****************************************************************************/
+void packet_Reset( void )
+{
+}
+
+/*****************************************************************************
+ * packet_InputStatus
+ *****************************************************************************/
+uint8_t packet_InputStatus( uint8_t *p_answer, ssize_t *pi_size )
+{
+    struct ret_input_status *p_ret = (struct ret_input_status *)p_answer;
+    struct tpacket_stats_v3 stats;
+    socklen_t i_len = sizeof(stats);
+
+    /* The kernel resets its counters on each read */
+    if ( getsockopt( i_handle, SOL_PACKET, PACKET_STATISTICS, &stats,
+                     &i_len ) == 0 )
+        i_nb_dropped += stats.tp_drops;
+
+    memset( p_ret, 0, sizeof(struct ret_input_status) );
+    p_ret->i_nb_paths = 1;
+    p_ret->i_lost = i_nb_lost;
+    p_ret->paths[0].i_datagrams = i_nb_datagrams;
+    p_ret->paths[0].i_forwarded = i_nb_datagrams;
+    p_ret->paths[0].i_lost = i_nb_lost;
+    p_ret->paths[0].i_dropped = i_nb_dropped;
+
+    *pi_size = sizeof(struct ret_input_status);
+    return RET_INPUT_STATUS;
+}
+
+#endif
@@ -0,0 +1,253 @@
+/*****************************************************************************
+ * pool.c: preallocated memory pools for blocks and packets
+ *****************************************************************************
+ * Copyright (C) 2026 VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "dvblast.h"
+#include "en50221.h"
+#include "comm.h"
+
+/*****************************************************************************
+ * Local declarations
+ *****************************************************************************/
+#define POOL_ALIGN 64 /* cache line */
+#define POOL_HUGEPAGE_SIZE (2 * 1024 * 1024)
+#ifdef MAP_POPULATE
+#   define POOL_MAP_FLAGS (MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE)
+#else
+#   define POOL_MAP_FLAGS (MAP_PRIVATE | MAP_ANONYMOUS)
+#endif
+
+struct pool_t
+{
+    pthread_mutex_t lock;
+    bool b_shared;
+    bool b_hugepages;
+    uint8_t *p_base;
+    size_t i_map_size;
+    size_t i_slot_size;
+    uint32_t i_slots;
+    uint32_t i_fresh;    /* slots from i_fresh on were never allocated */
+    void *p_free;        /* free list, linked through the first word */
+    uint32_t i_used, i_high_water;
+    uint64_t i_exhausted;
+};
+
+static pool_t *p_block_pool = NULL;
+
+/*****************************************************************************
+ * pool_New: maps an arena of i_size bytes cut in cache-line-aligned slots,
+ * on hugepages if possible; b_shared pools may be used from several threads
+ *****************************************************************************/
+pool_t *pool_New( size_t i_slot_size, size_t i_size, bool b_hugepages,
+                  bool b_shared )
+{
+    pool_t *p_pool = calloc( 1, sizeof(pool_t) );
+    void *p_base = MAP_FAILED;
+
+    p_pool->b_shared = b_shared;
+    if ( b_shared )
+        pthread_mutex_init( &p_pool->lock, NULL );
+    p_pool->i_slot_size = (i_slot_size + POOL_ALIGN - 1) & ~(POOL_ALIGN - 1);
+    if ( !i_size )
+        return p_pool;
+
+#ifdef MAP_HUGETLB
+    if ( b_hugepages )
+    {
+        i_size = (i_size + POOL_HUGEPAGE_SIZE - 1)
+                   & ~(size_t)(POOL_HUGEPAGE_SIZE - 1);
+        p_base = mmap( NULL, i_size, PROT_READ | PROT_WRITE,
+                       POOL_MAP_FLAGS | MAP_HUGETLB, -1, 0 );
+        if ( p_base == MAP_FAILED )
+            msg_Warn( NULL, "couldn't map hugepages (%s), using normal pages",
+                      strerror(errno) );
+        else
+            p_pool->b_hugepages = true;
+    }
+#endif
+
+    if ( p_base == MAP_FAILED )
+    {
+        p_base = mmap( NULL, i_size, PROT_READ | PROT_WRITE,
+                       POOL_MAP_FLAGS, -1, 0 );
+        if ( p_base == MAP_FAILED )
+        {
+            msg_Warn( NULL, "couldn't map memory pool (%s)", strerror(errno) );
+            return p_pool;
+        }
+#ifdef MADV_HUGEPAGE
+        if ( b_hugepages )
+            madvise( p_base, i_size, MADV_HUGEPAGE );
+#endif
+    }
+
+    p_pool->p_base = p_base;
+    p_pool->i_map_size = i_size;
+    p_pool->i_slots = i_size / p_pool->i_slot_size;
+    return p_pool;
+}
+
+/*****************************************************************************
+ * pool_Alloc: returns a slot, or falls back to malloc() if the pool is
+ * exhausted or i_size doesn't fit in a slot
+ *****************************************************************************/
+void *pool_Alloc( pool_t *p_pool, size_t i_size )
+{
+    void *p_slot = NULL;
+
+    if ( i_size > p_pool->i_slot_size || !p_pool->i_slots )
+        return malloc( i_size );
+
+    if ( p_pool->b_shared )
+        pthread_mutex_lock( &p_pool->lock );
+
+    if ( p_pool->p_free != NULL )
+    {
+        p_slot = p_pool->p_free;
+        p_pool->p_free = *(void **)p_slot;
+    }
+    else if ( p_pool->i_fresh < p_pool->i_slots )
+        p_slot = p_pool->p_base
+                   + (size_t)p_pool->i_fresh++ * p_pool->i_slot_size;
+
+    if ( p_slot != NULL )
+    {
+        if ( ++p_pool->i_used > p_pool->i_high_water )
+            p_pool->i_high_water = p_pool->i_used;
+    }
+    else
+        p_pool->i_exhausted++;
+
+    if ( p_pool->b_shared )
+        pthread_mutex_unlock( &p_pool->lock );
+
+    return p_slot != NULL ? p_slot : malloc( i_size );
+}
+
+/*****************************************************************************
+ * pool_Free
+ *****************************************************************************/
+void pool_Free( pool_t *p_pool, void *p_slot )
+{
+    if ( (uint8_t *)p_slot < p_pool->p_base
+          || (uint8_t *)p_slot >= p_pool->p_base + p_pool->i_map_size )
+    {
+        free( p_slot );
+        return;
+    }
+
+    if ( p_pool->b_shared )
+        pthread_mutex_lock( &p_pool->lock );
+    *(void **)p_slot = p_pool->p_free;
+    p_pool->p_free = p_slot;
+    p_pool->i_used--;
+    if ( p_pool->b_shared )
+        pthread_mutex_unlock( &p_pool->lock );
+}
+
+/*****************************************************************************
+ * pool_Delete: all slots must have been returned
+ *****************************************************************************/
+void pool_Delete( pool_t *p_pool )
+{
+    if ( p_pool->i_used )
+        msg_Dbg( NULL, "%u slots still in use in memory pool",
+                  p_pool->i_used );
+    else if ( p_pool->p_base != NULL )
+        munmap( p_pool->p_base, p_pool->i_map_size );
+    if ( p_pool->b_shared )
+        pthread_mutex_destroy( &p_pool->lock );
+    free( p_pool );
+}
+
+/*****************************************************************************
+ * pool_Status: statistics for dvblastctl
+ *****************************************************************************/
+void pool_Status( pool_t *p_pool, struct ret_pool *p_ret )
+{
+    memset( p_ret, 0, sizeof(struct ret_pool) );
+    if ( p_pool == NULL )
+        return;
+
+    if ( p_pool->b_shared )
+        pthread_mutex_lock( &p_pool->lock );
+    p_ret->i_slot_size = p_pool->i_slot_size;
+    p_ret->i_slots = p_pool->i_slots;
+    p_ret->i_used = p_pool->i_used;
+    p_ret->i_high_water = p_pool->i_high_water;
+    p_ret->i_exhausted = p_pool->i_exhausted;
+    p_ret->b_hugepages = p_pool->b_hugepages;
+    if ( p_pool->b_shared )
+        pthread_mutex_unlock( &p_pool->lock );
+}
+
+/*****************************************************************************
+ * block_Init
+ *****************************************************************************/
+void block_Init( size_t i_size, bool b_hugepages )
+{
+    p_block_pool = pool_New( sizeof(block_t), i_size, b_hugepages, false );
+}
+
+/*****************************************************************************
+ * block_New
+ *****************************************************************************/
+block_t *block_New( void )
+{
+    block_t *p_block = pool_Alloc( p_block_pool, sizeof(block_t) );
+
+    p_block->p_next = NULL;
+    p_block->i_refcount = 1;
+    return p_block;
+}
+
+/*****************************************************************************
+ * block_Delete
+ *****************************************************************************/
+void block_Delete( block_t *p_block )
+{
+    pool_Free( p_block_pool, p_block );
+}
+
+/*****************************************************************************
+ * block_Status
+ *****************************************************************************/
+void block_Status( struct ret_pool *p_ret )
+{
+    pool_Status( p_block_pool, p_ret );
+}
+
+/*****************************************************************************
+ * block_Vacuum
+ *****************************************************************************/
+void block_Vacuum( void )
+{
+    pool_Delete( p_block_pool );
+    p_block_pool = NULL;
+}
@@ -0,0 +1,424 @@
+/*****************************************************************************
+ * record.c: recording of outputs to local files
+ *****************************************************************************
+ * Copyright (C) 2026 VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+#define _GNU_SOURCE /* O_DIRECT */
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <ev.h>
+
+#include <bitstream/common.h>
+#include <bitstream/mpeg/ts.h>
+#include <bitstream/mpeg/psi.h>
+#include <bitstream/dvb/si.h>
+
+#include "dvblast.h"
+
+/*****************************************************************************
+ * Local declarations
+ *****************************************************************************/
+#define RECORD_BUFFER_SIZE (1024 * 1024) /* bytes per write */
+#define RECORD_ALIGN 4096 /* O_DIRECT buffer and size alignment */
+#define RECORD_MAX_NAME 1024
+#define RECORD_MAX_INDEX 1000 /* suffixes tried for existing files */
+#define RECORD_SUFFIX_SIZE 4 /* ".999" */
+#define RECORD_PSI_PIDS 16 /* PAT, SDT and PMTs */
+#define RECORD_PSI_PACKETS 8 /* per section */
+
+typedef struct record_psi_t
+{
+    uint16_t i_pid;
+    int i_nb_packets;
+    uint8_t pp_packets[RECORD_PSI_PACKETS][TS_SIZE];
+} record_psi_t;
+
+struct record_t
+{
+    char *psz_path; /* strftime() pattern */
+    char psz_name[RECORD_MAX_NAME];
+    int i_fd;
+    bool b_direct, b_error;
+    time_t i_rotate, i_next_rotate;
+    uint64_t i_max_size, i_size;
+
+    uint8_t *p_buffer;
+    size_t i_buffer;
+
+    /* TS packet being gathered from the iovec */
+    uint8_t p_ts[TS_SIZE];
+    size_t i_ts;
+
+    /* Last section of the PSI PIDs, written at the start of each file */
+    record_psi_t p_psi[RECORD_PSI_PIDS];
+    int i_nb_psi;
+    bool b_start;
+};
+
+/*****************************************************************************
+ * record_Flush: writes the buffer; except for the last write of a file, its
+ * size is a multiple of RECORD_ALIGN
+ *****************************************************************************/
+static void record_Flush( record_t *p_record, bool b_last )
+{
+    size_t i_written = 0;
+
+    if ( p_record->i_fd < 0 || !p_record->i_buffer )
+    {
+        p_record->i_buffer = 0;
+        return;
+    }
+
+    if ( b_last && p_record->b_direct
+          && p_record->i_buffer % RECORD_ALIGN )
+        fcntl( p_record->i_fd, F_SETFL,
+               fcntl( p_record->i_fd, F_GETFL ) & ~O_DIRECT );
+
+    while ( i_written < p_record->i_buffer )
+    {
+        ssize_t i_ret = write( p_record->i_fd, p_record->p_buffer + i_written,
+                               p_record->i_buffer - i_written );
+        if ( i_ret < 0 && errno == EINTR )
+            continue;
+        if ( i_ret < 0 && errno == EINVAL && p_record->b_direct )
+        {
+            msg_Warn( NULL, "O_DIRECT is not supported for %s, disabling",
+                      p_record->psz_name );
+            p_record->b_direct = false;
+            fcntl( p_record->i_fd, F_SETFL,
+                   fcntl( p_record->i_fd, F_GETFL ) & ~O_DIRECT );
+            continue;
+        }
+        if ( i_ret <= 0 )
+        {
+            if ( !p_record->b_error )
+                msg_Err( NULL, "couldn't write to %s (%s)", p_record->psz_name,
+                         strerror(errno) );
+            p_record->b_error = true;
+            break;
+        }
+        i_written += i_ret;
+    }
+    if ( i_written == p_record->i_buffer )
+        p_record->b_error = false;
+
+    p_record->i_buffer = 0;
+}
+
+/*****************************************************************************
+ * record_CloseFile
+ *****************************************************************************/
+static void record_CloseFile( record_t *p_record )
+{
+    if ( p_record->i_fd < 0 )
+        return;
+
+    record_Flush( p_record, true );
+    close( p_record->i_fd );
+    p_record->i_fd = -1;
+    msg_Dbg( NULL, "closed recording %s", p_record->psz_name );
+}
+
+/*****************************************************************************
+ * record_OpenFile: starts a new file; existing files are never overwritten,
+ * a suffix is added instead
+ *****************************************************************************/
+static bool record_OpenFile( record_t *p_record )
+{
+    time_t i_now = time( NULL );
+    char psz_base[RECORD_MAX_NAME - RECORD_SUFFIX_SIZE];
+    struct tm tm;
+    int i;
+
+    localtime_r( &i_now, &tm );
+    if ( !strftime( psz_base, sizeof(psz_base), p_record->psz_path, &tm ) )
+    {
+        msg_Err( NULL, "invalid recording path %s", p_record->psz_path );
+        p_record->i_next_rotate = i_now + 1;
+        return false;
+    }
+
+    for ( i = 0; i < RECORD_MAX_INDEX; i++ )
+    {
+        if ( i )
+            snprintf( p_record->psz_name, sizeof(p_record->psz_name), "%s.%d",
+                      psz_base, i );
+        else
+            strcpy( p_record->psz_name, psz_base );
+
+        p_record->i_fd = open( p_record->psz_name,
+                               O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC
+                                | (p_record->b_direct ? O_DIRECT : 0), 0644 );
+        if ( p_record->i_fd >= 0 || errno != EEXIST )
+            break;
+    }
+
+    if ( p_record->i_fd < 0 && p_record->b_direct && errno == EINVAL )
+    {
+        msg_Warn( NULL, "O_DIRECT is not supported for %s, disabling",
+                  p_record->psz_name );
+        p_record->b_direct = false;
+        return record_OpenFile( p_record );
+    }
+    if ( p_record->i_fd < 0 )
+    {
+        msg_Err( NULL, "couldn't create %s (%s)", p_record->psz_name,
+                 i == RECORD_MAX_INDEX ? "too many files" : strerror(errno) );
+        /* Packets are dropped until the next try */
+        p_record->i_next_rotate = i_now + 1;
+        return false;
+    }
+
+    msg_Info( NULL, "recording to %s", p_record->psz_name );
+    p_record->i_size = 0;
+    p_record->b_start = true;
+    if ( p_record->i_rotate )
+        p_record->i_next_rotate = (i_now / p_record->i_rotate + 1)
+                                   * p_record->i_rotate;
+    return true;
+}
+
+/*****************************************************************************
+ * record_Append: copies data to the buffer, which is written when full
+ *****************************************************************************/
+static void record_Append( record_t *p_record, const uint8_t *p_data,
+                           size_t i_len )
+{
+    p_record->i_size += i_len;
+
+    while ( i_len )
+    {
+        size_t i_copy = RECORD_BUFFER_SIZE - p_record->i_buffer;
+        if ( i_copy > i_len )
+            i_copy = i_len;
+
+        memcpy( p_record->p_buffer + p_record->i_buffer, p_data, i_copy );
+        p_record->i_buffer += i_copy;
+        p_data += i_copy;
+        i_len -= i_copy;
+
+        if ( p_record->i_buffer == RECORD_BUFFER_SIZE )
+            record_Flush( p_record, false );
+    }
+}
+
+/*****************************************************************************
+ * record_ParsePAT: updates the PMT PIDs from a PAT contained in one packet
+ *****************************************************************************/
+static void record_ParsePAT( record_t *p_record, uint8_t *p_ts )
+{
+    uint8_t *p_section = ts_section( p_ts );
+    uint8_t *p_program;
+    int i, j, i_nb_psi = 2;
+
+    if ( p_section + PSI_HEADER_SIZE > p_ts + TS_SIZE
+          || psi_get_tableid( p_section ) != PAT_TID
+          || p_section + PSI_HEADER_SIZE + psi_get_length( p_section )
+              > p_ts + TS_SIZE )
+        return;
+
+    for ( i = 0; (p_program = pat_get_program( p_section, i )) != NULL
+                  && i_nb_psi < RECORD_PSI_PIDS; i++ )
+    {
+        uint16_t i_pid = patn_get_pid( p_program );
+
+        if ( !patn_get_program( p_program ) )
+            continue; /* NIT */
+
+        /* Keep the cached sections of the PIDs which are still there */
+        for ( j = i_nb_psi; j < p_record->i_nb_psi; j++ )
+            if ( p_record->p_psi[j].i_pid == i_pid )
+                break;
+        if ( j < p_record->i_nb_psi )
+        {
+            record_psi_t psi = p_record->p_psi[j];
+            p_record->p_psi[j] = p_record->p_psi[i_nb_psi];
+            p_record->p_psi[i_nb_psi] = psi;
+        }
+        else
+        {
+            p_record->p_psi[i_nb_psi].i_pid = i_pid;
+            p_record->p_psi[i_nb_psi].i_nb_packets = 0;
+        }
+        i_nb_psi++;
+    }
+    p_record->i_nb_psi = i_nb_psi;
+}
+
+/*****************************************************************************
+ * record_Packet: handles a complete TS packet
+ *****************************************************************************/
+static void record_Packet( record_t *p_record, uint8_t *p_ts )
+{
+    uint16_t i_pid = ts_get_pid( p_ts );
+    int i;
+
+    if ( p_record->b_start )
+    {
+        /* Make every file decodable on its own */
+        for ( i = 0; i < p_record->i_nb_psi; i++ )
+        {
+            int j;
+            for ( j = 0; j < p_record->p_psi[i].i_nb_packets; j++ )
+                record_Append( p_record, p_record->p_psi[i].pp_packets[j],
+                               TS_SIZE );
+        }
+        p_record->b_start = false;
+    }
+
+    for ( i = 0; i < p_record->i_nb_psi; i++ )
+    {
+        record_psi_t *p_psi = &p_record->p_psi[i];
+
+        if ( p_psi->i_pid != i_pid )
+            continue;
+        if ( ts_get_unitstart( p_ts ) )
+            p_psi->i_nb_packets = 0;
+        if ( p_psi->i_nb_packets < RECORD_PSI_PACKETS )
+            memcpy( p_psi->pp_packets[p_psi->i_nb_packets++], p_ts, TS_SIZE );
+        if ( i_pid == PAT_PID && ts_get_unitstart( p_ts ) )
+            record_ParsePAT( p_record, p_ts );
+        break;
+    }
+
+    record_Append( p_record, p_ts, TS_SIZE );
+}
+
+/*****************************************************************************
+ * record_Open: starts the recording of an output
+ *****************************************************************************/
+record_t *record_Open( const output_config_t *p_config )
+{
+    record_t *p_record = calloc( 1, sizeof(record_t) );
+
+    if ( posix_memalign( (void **)&p_record->p_buffer, RECORD_ALIGN,
+                         RECORD_BUFFER_SIZE ) )
+    {
+        free( p_record );
+        return NULL;
+    }
+
+    p_record->psz_path = strdup( p_config->psz_path );
+    p_record->i_fd = -1;
+    p_record->b_direct = p_config->b_direct;
+    p_record->i_rotate = p_config->i_rotate;
+    p_record->i_max_size = p_config->i_rotate_size;
+    p_record->p_psi[0].i_pid = PAT_PID;
+    p_record->p_psi[1].i_pid = SDT_PID;
+    p_record->i_nb_psi = 2;
+
+    if ( !record_OpenFile( p_record ) )
+    {
+        record_Close( p_record );
+        return NULL;
+    }
+    return p_record;
+}
+
+/*****************************************************************************
+ * record_Change: updates the rotation parameters
+ *****************************************************************************/
+void record_Change( record_t *p_record, const output_config_t *p_config )
+{
+    if ( p_record->i_rotate != p_config->i_rotate )
+    {
+        p_record->i_rotate = p_config->i_rotate;
+        if ( p_record->i_rotate )
+            p_record->i_next_rotate = (time( NULL ) / p_record->i_rotate + 1)
+                                       * p_record->i_rotate;
+    }
+    p_record->i_max_size = p_config->i_rotate_size;
+}
+
+/*****************************************************************************
+ * record_Write: records the TS packets of an iovec, made of whole packets,
+ * split packets (header and payload) and empty entries
+ *****************************************************************************/
+void record_Write( record_t *p_record, const struct iovec *p_iov, int i_iov )
+{
+    int i;
+
+    if ( p_record->i_fd < 0 )
+    {
+        /* Retry after the back-off set by the failed open */
+        if ( time( NULL ) >= p_record->i_next_rotate )
+            record_OpenFile( p_record );
+    }
+    else if ( (p_record->i_rotate && time( NULL ) >= p_record->i_next_rotate)
+               || (p_record->i_max_size
+                    && p_record->i_size >= p_record->i_max_size) )
+    {
+        record_CloseFile( p_record );
+        record_OpenFile( p_record );
+    }
+
+    for ( i = 0; i < i_iov; i++ )
+    {
+        const uint8_t *p_data = p_iov[i].iov_base;
+        size_t i_len = p_iov[i].iov_len;
+
+        if ( !p_record->i_ts && i_len == TS_SIZE )
+        {
+            /* Fast path, whole packet */
+            memcpy( p_record->p_ts, p_data, TS_SIZE );
+            record_Packet( p_record, p_record->p_ts );
+            continue;
+        }
+
+        while ( i_len )
+        {
+            size_t i_copy = TS_SIZE - p_record->i_ts;
+            if ( i_copy > i_len )
+                i_copy = i_len;
+
+            memcpy( p_record->p_ts + p_record->i_ts, p_data, i_copy );
+            p_record->i_ts += i_copy;
+            p_data += i_copy;
+            i_len -= i_copy;
+
+            if ( p_record->i_ts == TS_SIZE )
+            {
+                record_Packet( p_record, p_record->p_ts );
+                p_record->i_ts = 0;
+            }
+        }
+    }
+}
+
+/*****************************************************************************
+ * record_Close: writes the end of the recording and frees it
+ *****************************************************************************/
+void record_Close( record_t *p_record )
+{
+    record_CloseFile( p_record );
+    free( p_record->p_buffer );
+    free( p_record->psz_path );
+    free( p_record );
+}
@@ -0,0 +1,260 @@
+/*****************************************************************************
+ * tssync.c: TS packet size detection and resynchronization on input
+ *****************************************************************************
+ * Copyright (C) 2026 VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <ev.h>
+
+#include <bitstream/common.h>
+#include <bitstream/mpeg/ts.h>
+
+#include "dvblast.h"
+
+/*****************************************************************************
+ * Local declarations
+ *****************************************************************************/
+#define SYNC_PACKETS 5 /* sync bytes checked to detect the packet size */
+
+/* Plain TS, Reed-Solomon parity after the packet, M2TS timestamp before it;
+ * in all cases the sync bytes are one packet size apart */
+static const unsigned int pi_sizes[] = { TS_SIZE, TS_SIZE + 16, TS_SIZE + 4 };
+
+static unsigned int i_packet_size = TS_SIZE;
+static bool b_ts_sync = true;
+static uint8_t *p_buffer = NULL, *p_joined = NULL;
+static size_t i_buffer_size = 0, i_joined_size = 0;
+
+/* Byte streams only: start of a packet, and parity or timestamp to skip */
+static uint8_t p_carry[TS_SIZE];
+static size_t i_carry = 0, i_skip = 0;
+
+/*****************************************************************************
+ * Local prototypes
+ *****************************************************************************/
+static block_t **tssync_Realign( const uint8_t *p_data, size_t i_len,
+                                 bool b_stream, mtime_t i_dts,
+                                 block_t **pp_current );
+
+/*****************************************************************************
+ * tssync_Find: returns the offset of the first sync byte followed by others
+ * at a known packet size, which is stored in *pi_size (-1 if none)
+ *****************************************************************************/
+ssize_t tssync_Find( const uint8_t *p_data, size_t i_len,
+                     unsigned int *pi_size )
+{
+    size_t i_pos;
+    int i, k;
+
+    for ( i_pos = 0; i_pos + TS_SIZE <= i_len; i_pos++ )
+    {
+        if ( p_data[i_pos] != 0x47 )
+            continue;
+
+        /* Try the current size first */
+        for ( i = -1; i < (int)(sizeof(pi_sizes) / sizeof(pi_sizes[0])); i++ )
+        {
+            unsigned int i_size = i < 0 ? *pi_size : pi_sizes[i];
+
+            for ( k = 1; k < SYNC_PACKETS && i_pos + k * i_size < i_len; k++ )
+                if ( p_data[i_pos + k * i_size] != 0x47 )
+                    break;
+
+            if ( k < SYNC_PACKETS && i_pos + k * i_size < i_len )
+                continue;
+            /* A lone packet at the end only confirms the current size */
+            if ( k == 1 && i_size != *pi_size )
+                continue;
+
+            *pi_size = i_size;
+            return i_pos;
+        }
+    }
+
+    return -1;
+}
+
+/*****************************************************************************
+ * tssync_Run: takes a chain of blocks holding i_len bytes of input (the last
+ * block may be partial) and appends the realigned TS packets to pp_current;
+ * b_stream carries incomplete packets over to the next call
+ *****************************************************************************/
+block_t **tssync_Run( block_t *p_blocks, size_t i_len, bool b_stream,
+                      block_t **pp_current )
+{
+    block_t *p_block;
+    size_t i_pos;
+
+    if ( p_blocks == NULL )
+        return pp_current;
+
+    /* Fast path: aligned 188-byte packets are passed as is */
+    if ( i_packet_size == TS_SIZE && !i_carry && !i_skip
+          && i_len % TS_SIZE == 0 )
+    {
+        for ( p_block = p_blocks; p_block != NULL; p_block = p_block->p_next )
+            if ( !ts_validate( p_block->p_ts ) )
+                break;
+
+        if ( p_block == NULL )
+        {
+            *pp_current = p_blocks;
+            while ( *pp_current != NULL )
+                pp_current = &(*pp_current)->p_next;
+            return pp_current;
+        }
+    }
+
+    if ( i_len > i_buffer_size )
+    {
+        p_buffer = realloc( p_buffer, i_len );
+        i_buffer_size = i_len;
+    }
+
+    for ( i_pos = 0, p_block = p_blocks; p_block != NULL && i_pos < i_len;
+          p_block = p_block->p_next )
+    {
+        size_t i_copy = i_len - i_pos < TS_SIZE ? i_len - i_pos : TS_SIZE;
+        memcpy( p_buffer + i_pos, p_block->p_ts, i_copy );
+        i_pos += i_copy;
+    }
+
+    pp_current = tssync_Realign( p_buffer, i_pos, b_stream, p_blocks->i_dts,
+                                 pp_current );
+    block_DeleteChain( p_blocks );
+    return pp_current;
+}
+
+/*****************************************************************************
+ * tssync_RunBuffer: same as tssync_Run, for inputs reading into a buffer
+ *****************************************************************************/
+block_t **tssync_RunBuffer( const uint8_t *p_data, size_t i_len,
+                            bool b_stream, block_t **pp_current )
+{
+    if ( i_packet_size == TS_SIZE && !i_carry && !i_skip )
+    {
+        /* Fast path: copy aligned 188-byte packets */
+        while ( i_len >= TS_SIZE && ts_validate( p_data ) )
+        {
+            *pp_current = block_New();
+            memcpy( (*pp_current)->p_ts, p_data, TS_SIZE );
+            pp_current = &(*pp_current)->p_next;
+            p_data += TS_SIZE;
+            i_len -= TS_SIZE;
+        }
+        if ( !i_len )
+            return pp_current;
+    }
+
+    return tssync_Realign( p_data, i_len, b_stream, 0, pp_current );
+}
+
+/*****************************************************************************
+ * tssync_Realign: slow path, finds the sync bytes and strips the extra bytes
+ * of 192 and 204-byte packets
+ *****************************************************************************/
+static block_t **tssync_Realign( const uint8_t *p_data, size_t i_len,
+                                 bool b_stream, mtime_t i_dts,
+                                 block_t **pp_current )
+{
+    size_t i_pos = 0;
+
+    if ( b_stream )
+    {
+        if ( i_skip >= i_len )
+        {
+            i_skip -= i_len;
+            return pp_current;
+        }
+        p_data += i_skip;
+        i_len -= i_skip;
+        i_skip = 0;
+
+        if ( i_carry )
+        {
+            /* Prepend the incomplete packet of the previous call */
+            if ( i_carry + i_len > i_joined_size )
+            {
+                i_joined_size = i_carry + i_len;
+                p_joined = realloc( p_joined, i_joined_size );
+            }
+            memcpy( p_joined + i_carry, p_data, i_len );
+            memcpy( p_joined, p_carry, i_carry );
+            p_data = p_joined;
+            i_len += i_carry;
+            i_carry = 0;
+        }
+    }
+
+    while ( i_pos + TS_SIZE <= i_len )
+    {
+        if ( p_data[i_pos] != 0x47 )
+        {
+            unsigned int i_size = i_packet_size;
+            ssize_t i_sync;
+
+            if ( b_ts_sync )
+                msg_Warn( NULL, "lost TS sync" );
+            b_ts_sync = false;
+
+            i_sync = tssync_Find( p_data + i_pos, i_len - i_pos, &i_size );
+            if ( i_sync < 0 )
+            {
+                /* Keep what may be the beginning of a packet */
+                i_pos = i_len - (TS_SIZE - 1);
+                break;
+            }
+
+            i_pos += i_sync;
+            if ( i_size != i_packet_size )
+            {
+                msg_Info( NULL, "detected %u-byte TS packets", i_size );
+                i_packet_size = i_size;
+            }
+            msg_Dbg( NULL, "TS sync recovered" );
+            b_ts_sync = true;
+        }
+
+        *pp_current = block_New();
+        memcpy( (*pp_current)->p_ts, p_data + i_pos, TS_SIZE );
+        (*pp_current)->i_dts = i_dts;
+        pp_current = &(*pp_current)->p_next;
+        i_pos += i_packet_size;
+    }
+
+    if ( b_stream )
+    {
+        if ( i_pos > i_len )
+            i_skip = i_pos - i_len;
+        else
+        {
+            i_carry = i_len - i_pos;
+            memcpy( p_carry, p_data + i_pos, i_carry );
+        }
+    }
+
+    return pp_current;
+}
@@ -20,10 +20,15 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
  *****************************************************************************/
 
+#if defined(__linux__)
+#define _GNU_SOURCE /* recvmmsg() */
+#endif
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <string.h>
 #include <sys/types.h>
@@ -44,42 +49,214 @@
 #include <bitstream/ietf/rtp.h>
 
 #include "dvblast.h"
+#include "en50221.h"
+#include "comm.h"
+
+#ifdef HAVE_SO_TIMESTAMPING
+#include <time.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
+#endif
 
 /*****************************************************************************
  * Local declarations
  *****************************************************************************/
 #define PRINT_REFRACTORY_PERIOD 1000000 /* 1 s */
+#define REORDER_SLOTS 4096 /* must be a power of 2 */
+#define CMSG_BUFFER_SIZE 256
+
+#define RX_TIMESTAMP_NONE 0
+#define RX_TIMESTAMP_SOFTWARE 1
+#define RX_TIMESTAMP_HARDWARE 2
+#define HW_OFFSET_MAX_JUMP 1000000 /* 1 s */
+#define HW_OFFSET_DRIFT_FACTOR 64
+
+/* One path per -D source; a second one is merged hitlessly by sequence
+ * number (SMPTE 2022-7 style) */
+typedef struct udp_path_t
+{
+    int i_handle;
+    struct ev_io watcher;
+    mtime_t i_last_print;
+    struct sockaddr_storage last_addr;
 
-static int i_handle;
-static struct ev_io udp_watcher;
+    /* Offset between the NIC clock and mdate(), for hardware timestamps */
+    int i_rx_timestamp;
+    mtime_t i_hw_offset;
+    bool b_hw_offset;
+
+    /* RTP source of the path, redundant paths may have different SSRCs */
+    uint8_t pi_ssrc[4];
+    bool b_ssrc;
+
+    /* Per-path statistics */
+    uint16_t i_next_seqnum;
+    bool b_seqnum;
+    uint64_t i_datagrams, i_forwarded, i_lost;
+} udp_path_t;
+
+static udp_path_t p_paths[INPUT_MAX_PATHS];
+static int i_nb_paths = 0;
 static struct ev_timer mute_watcher;
 static bool b_udp = false;
 static int i_block_cnt;
-static uint8_t pi_ssrc[4] = { 0, 0, 0, 0 };
 static uint16_t i_seqnum = 0;
 static bool b_sync = false;
-static mtime_t i_last_print = 0;
-static struct sockaddr_storage last_addr;
+
+/* Batched reception: up to i_batch datagrams are drained per wakeup */
+static int i_batch = DEFAULT_UDP_BATCH;
+static block_t *p_freelist = NULL;
+static block_t **pp_blocks;
+static uint8_t *p_rtp_hdrs;
+static struct iovec *p_iovs;
+#ifdef HAVE_RECVMMSG
+static struct mmsghdr *p_msgs;
+#endif
+
+/* Kernel receive timestamps, dating each datagram on arrival */
+static bool b_rx_timestamps = false;
+static uint8_t *p_cmsgs = NULL;
+static mtime_t *p_arrivals;
+
+/* Datagrams per wakeup, to tune the batch depth */
+static struct ev_timer print_watcher;
+static uint64_t i_nb_wakeups = 0, i_nb_datagrams = 0, i_nb_full_batches = 0;
+static int i_max_datagrams = 0;
+
+/* RTP reordering: datagrams are held for at most i_reorder_window */
+typedef struct reorder_slot_t
+{
+    block_t *p_blocks;
+    mtime_t i_date;
+    uint16_t i_seqnum;
+    bool b_used;
+    bool b_released;
+} reorder_slot_t;
+
+static mtime_t i_reorder_window = 0;
+static reorder_slot_t *p_reorder = NULL;
+static int i_reorder_held = 0;
+static uint16_t i_reorder_next, i_reorder_last;
+static bool b_reorder_sync = false;
+static struct ev_timer reorder_watcher;
+static uint64_t i_nb_reordered = 0, i_nb_late = 0, i_nb_duplicates = 0,
+                i_nb_lost = 0;
+static uint64_t i_total_lost = 0;
 
 /*****************************************************************************
  * Local prototypes
  *****************************************************************************/
 static void udp_Read(struct ev_loop *loop, struct ev_io *w, int revents);
 static void udp_MuteCb(struct ev_loop *loop, struct ev_timer *w, int revents);
+static void udp_PrintCb(struct ev_loop *loop, struct ev_timer *w, int revents);
+static int udp_OpenPath( udp_path_t *p_path, const char *psz_src,
+                         int *pi_mtu );
+static void udp_InitBatch( void );
+static bool udp_CheckRTP( udp_path_t *p_path, const uint8_t *p_rtp_hdr );
+#ifdef HAVE_SO_TIMESTAMPING
+static void udp_EnableTimestamps( int i_handle, int i_rx_timestamp,
+                                  const char *psz_ifname );
+static mtime_t udp_GetArrival( udp_path_t *p_path, struct msghdr *p_mh,
+                               mtime_t i_realtime_offset );
+#endif
+static void udp_Demux( block_t *p_ts );
+static block_t **udp_ReorderPut( udp_path_t *p_path, uint16_t i_rtp_seqnum,
+                                 block_t *p_blocks, block_t **pp_current );
+static block_t **udp_ReorderRelease( block_t **pp_current, bool b_flush );
+static void udp_ReorderCb(struct ev_loop *loop, struct ev_timer *w, int revents);
 
 /*****************************************************************************
  * udp_Open
  *****************************************************************************/
 void udp_Open( void )
 {
-    int i_family;
+    int i_family, i_mtu = 0;
+
+    i_family = udp_OpenPath( &p_paths[0], psz_udp_src, &i_mtu );
+    i_nb_paths = 1;
+    if ( psz_udp_src2 != NULL )
+    {
+        udp_OpenPath( &p_paths[1], psz_udp_src2, &i_mtu );
+        i_nb_paths = 2;
+    }
+
+    if ( !i_mtu )
+        i_mtu = i_family == AF_INET6 ? DEFAULT_IPV6_MTU : DEFAULT_IPV4_MTU;
+    /* Round up so that datagrams of 192 or 204-byte packets fit */
+    i_block_cnt = (i_mtu - (b_udp ? 0 : RTP_HEADER_SIZE) + TS_SIZE - 1)
+                    / TS_SIZE;
+
+    if ( i_batch < 1 || i_batch > MAX_UDP_BATCH )
+    {
+        msg_Warn( NULL, "invalid batch depth %d, using %d", i_batch,
+                  DEFAULT_UDP_BATCH );
+        i_batch = DEFAULT_UDP_BATCH;
+    }
+#ifndef HAVE_RECVMMSG
+    if ( i_batch > 1 )
+    {
+        msg_Warn( NULL, "recvmmsg() is unsupported, reading one datagram per wakeup" );
+        i_batch = 1;
+    }
+#endif
+#if !defined(HAVE_SO_TIMESTAMPING) || !defined(HAVE_RECVMMSG)
+    if ( b_rx_timestamps )
+    {
+        msg_Warn( NULL, "kernel timestamps are unsupported, ignoring timestamp option" );
+        b_rx_timestamps = false;
+    }
+#endif
+    udp_InitBatch();
+
+    if ( i_nb_paths > 1 )
+    {
+        /* Merging is done in the reorder buffer, which must cover the
+         * delay between both paths */
+        if ( b_udp )
+        {
+            msg_Err( NULL, "merging two inputs needs RTP" );
+            exit(EXIT_FAILURE);
+        }
+        if ( i_reorder_window <= 0 )
+            i_reorder_window = DEFAULT_UDP_MERGE_WINDOW;
+    }
+
+    if ( i_reorder_window > 0 )
+    {
+        if ( b_udp )
+            msg_Warn( NULL, "reordering needs RTP, ignoring reorder option" );
+        else
+        {
+            p_reorder = calloc( REORDER_SLOTS, sizeof(reorder_slot_t) );
+            ev_timer_init(&reorder_watcher, udp_ReorderCb, 0., 0.);
+        }
+    }
+
+    ev_timer_init(&mute_watcher, udp_MuteCb,
+                  i_udp_lock_timeout / 1000000., i_udp_lock_timeout / 1000000.);
+
+    if ( i_print_period && (i_batch > 1 || p_reorder != NULL) )
+    {
+        ev_timer_init(&print_watcher, udp_PrintCb,
+                      i_print_period / 1000000., i_print_period / 1000000.);
+        ev_timer_start(event_loop, &print_watcher);
+    }
+}
+
+/*****************************************************************************
+ * udp_OpenPath: opens the socket of one input path, returns its family
+ *****************************************************************************/
+static int udp_OpenPath( udp_path_t *p_path, const char *psz_src,
+                         int *pi_mtu )
+{
+    int i_family, i_handle;
     struct addrinfo *p_connect_ai = NULL, *p_bind_ai;
     int i_if_index = 0;
     in_addr_t i_if_addr = INADDR_ANY;
-    int i_mtu = 0;
     char *psz_ifname = NULL;
+    int i_rx_timestamp = RX_TIMESTAMP_NONE;
 
-    char *psz_bind, *psz_string = strdup( psz_udp_src );
+    char *psz_bind, *psz_string = strdup( psz_src );
     char *psz_save = psz_string;
     int i = 1;
 
@@ -118,7 +295,24 @@ void udp_Open( void )
         if ( IS_OPTION("udp") )
             b_udp = true;
         else if ( IS_OPTION("mtu=") )
-            i_mtu = strtol( ARG_OPTION("mtu="), NULL, 0 );
+            *pi_mtu = strtol( ARG_OPTION("mtu="), NULL, 0 );
+        else if ( IS_OPTION("batch=") )
+            i_batch = strtol( ARG_OPTION("batch="), NULL, 0 );
+        else if ( IS_OPTION("reorder=") )
+            i_reorder_window = strtoll( ARG_OPTION("reorder="), NULL, 0 ) * 1000;
+        else if ( IS_OPTION("timestamp=") )
+        {
+            char *option = config_stropt( ARG_OPTION("timestamp=") );
+            if ( !strcasecmp( option, "hw" ) )
+                i_rx_timestamp = RX_TIMESTAMP_HARDWARE;
+            else if ( !strcasecmp( option, "sw" ) )
+                i_rx_timestamp = RX_TIMESTAMP_SOFTWARE;
+            else
+                msg_Warn( NULL, "unrecognized timestamp source %s", option );
+            free( option );
+        }
+        else if ( IS_OPTION("timestamp") )
+            i_rx_timestamp = RX_TIMESTAMP_SOFTWARE;
         else if ( IS_OPTION("ifindex=") )
             i_if_index = strtol( ARG_OPTION("ifindex="), NULL, 0 );
         else if ( IS_OPTION("ifaddr=") ) {
@@ -139,11 +333,6 @@ void udp_Open( void )
 #undef ARG_OPTION
     }
 
-    if ( !i_mtu )
-        i_mtu = i_family == AF_INET6 ? DEFAULT_IPV6_MTU : DEFAULT_IPV4_MTU;
-    i_block_cnt = (i_mtu - (b_udp ? 0 : RTP_HEADER_SIZE)) / TS_SIZE;
-
-
     /* Do stuff. */
 
     if ( (i_handle = socket( i_family, SOCK_DGRAM, IPPROTO_UDP )) < 0 )
@@ -160,6 +349,14 @@ void udp_Open( void )
 
     setsockopt( i_handle, SOL_SOCKET, SO_RCVBUF, (void *) &i, sizeof( i ) );
 
+    if ( i_rx_timestamp != RX_TIMESTAMP_NONE )
+    {
+#ifdef HAVE_SO_TIMESTAMPING
+        udp_EnableTimestamps( i_handle, i_rx_timestamp, psz_ifname );
+#endif
+        b_rx_timestamps = true;
+    }
+
     if ( bind( i_handle, p_bind_ai->ai_addr, p_bind_ai->ai_addrlen ) < 0 )
     {
         msg_Err( NULL, "couldn't bind (%s)", strerror(errno) );
@@ -270,15 +467,60 @@ void udp_Open( void )
     if ( p_connect_ai != NULL )
         freeaddrinfo( p_connect_ai );
     free( psz_save );
+    free( psz_ifname );
 
-    msg_Dbg( NULL, "binding socket to %s", psz_udp_src );
+    msg_Dbg( NULL, "binding socket to %s", psz_src );
 
-    ev_io_init(&udp_watcher, udp_Read, i_handle, EV_READ);
-    ev_io_start(event_loop, &udp_watcher);
+    memset( p_path, 0, sizeof(udp_path_t) );
+    p_path->i_handle = i_handle;
+    p_path->i_rx_timestamp = i_rx_timestamp;
+    ev_io_init(&p_path->watcher, udp_Read, i_handle, EV_READ);
+    p_path->watcher.data = p_path;
+    ev_io_start(event_loop, &p_path->watcher);
 
-    ev_timer_init(&mute_watcher, udp_MuteCb,
-                  i_udp_lock_timeout / 1000000., i_udp_lock_timeout / 1000000.);
-    memset(&last_addr, 0, sizeof(last_addr));
+    return i_family;
+}
+
+/*****************************************************************************
+ * udp_InitBatch: allocates the iovecs and headers for batched reception
+ *****************************************************************************/
+static void udp_InitBatch( void )
+{
+    int i_iov_cnt = i_block_cnt + (b_udp ? 0 : 1);
+    int i_msg, i_block;
+
+    pp_blocks = malloc( i_batch * i_block_cnt * sizeof(block_t *) );
+    p_rtp_hdrs = malloc( i_batch * RTP_HEADER_SIZE );
+    p_iovs = malloc( i_batch * i_iov_cnt * sizeof(struct iovec) );
+#ifdef HAVE_RECVMMSG
+    p_msgs = calloc( i_batch, sizeof(struct mmsghdr) );
+#endif
+    p_arrivals = malloc( i_batch * sizeof(mtime_t) );
+    if ( b_rx_timestamps )
+        p_cmsgs = malloc( i_batch * CMSG_BUFFER_SIZE );
+
+    for ( i_msg = 0; i_msg < i_batch; i_msg++ )
+    {
+        struct iovec *p_iov = &p_iovs[i_msg * i_iov_cnt];
+
+        if ( !b_udp )
+        {
+            /* FIXME : this is wrong if RTP header > 12 bytes */
+            p_iov->iov_base = &p_rtp_hdrs[i_msg * RTP_HEADER_SIZE];
+            p_iov->iov_len = RTP_HEADER_SIZE;
+            p_iov++;
+        }
+        for ( i_block = 0; i_block < i_block_cnt; i_block++ )
+            p_iov[i_block].iov_len = TS_SIZE;
+
+#ifdef HAVE_RECVMMSG
+        p_msgs[i_msg].msg_hdr.msg_iov = &p_iovs[i_msg * i_iov_cnt];
+        p_msgs[i_msg].msg_hdr.msg_iovlen = i_iov_cnt;
+        if ( p_cmsgs != NULL )
+            p_msgs[i_msg].msg_hdr.msg_control =
+                &p_cmsgs[i_msg * CMSG_BUFFER_SIZE];
+#endif
+    }
 }
 
 /*****************************************************************************
@@ -286,10 +528,12 @@ void udp_Open( void )
  *****************************************************************************/
 static void udp_Read(struct ev_loop *loop, struct ev_io *w, int revents)
 {
+    udp_path_t *p_path = (udp_path_t *)w->data;
+
     i_wallclock = mdate();
-    if ( i_last_print + PRINT_REFRACTORY_PERIOD < i_wallclock )
+    if ( p_path->i_last_print + PRINT_REFRACTORY_PERIOD < i_wallclock )
     {
-        i_last_print = i_wallclock;
+        p_path->i_last_print = i_wallclock;
 
         struct sockaddr_storage addr;
         struct msghdr mh = {
@@ -301,16 +545,16 @@ static void udp_Read(struct ev_loop *loop, struct ev_io *w, int revents)
             .msg_controllen = 0,
             .msg_flags = 0
         };
-        if ( recvmsg( i_handle, &mh, MSG_DONTWAIT | MSG_PEEK ) != -1 &&
+        if ( recvmsg( p_path->i_handle, &mh, MSG_DONTWAIT | MSG_PEEK ) != -1 &&
              mh.msg_namelen >= sizeof(struct sockaddr) )
         {
             char psz_addr[256], psz_port[42];
-            if ( memcmp( &addr, &last_addr, mh.msg_namelen ) &&
+            if ( memcmp( &addr, &p_path->last_addr, mh.msg_namelen ) &&
                  getnameinfo( (const struct sockaddr *)&addr, mh.msg_namelen,
                      psz_addr, sizeof(psz_addr), psz_port, sizeof(psz_port),
                      NI_DGRAM | NI_NUMERICHOST | NI_NUMERICSERV ) == 0 )
             {
-                memcpy( &last_addr, &addr, mh.msg_namelen );
+                memcpy( &p_path->last_addr, &addr, mh.msg_namelen );
 
                 msg_Info( NULL, "source: %s:%s", psz_addr, psz_port );
                 switch (i_print_type) {
@@ -327,79 +571,151 @@ static void udp_Read(struct ev_loop *loop, struct ev_io *w, int revents)
         }
     }
 
-    struct iovec p_iov[i_block_cnt + 1];
     block_t *p_ts, **pp_current = &p_ts;
-    int i_iov, i_block;
-    ssize_t i_len;
-    uint8_t p_rtp_hdr[RTP_HEADER_SIZE];
+    int i_iov_cnt = i_block_cnt + (b_udp ? 0 : 1);
+    int i_msg, i_block, i_nb_msgs;
+    unsigned int i_nb_blocks = 0;
 
-    if ( !b_udp )
+    /* Refill the iovecs from the free list */
+    for ( i_msg = 0; i_msg < i_batch; i_msg++ )
     {
-        /* FIXME : this is wrong if RTP header > 12 bytes */
-        p_iov[0].iov_base = p_rtp_hdr;
-        p_iov[0].iov_len = RTP_HEADER_SIZE;
-        i_iov = 1;
+        struct iovec *p_iov = &p_iovs[(i_msg + 1) * i_iov_cnt - i_block_cnt];
+
+        for ( i_block = 0; i_block < i_block_cnt; i_block++ )
+        {
+            block_t *p_block = p_freelist;
+            if ( p_block == NULL )
+                p_block = block_New();
+            else
+                p_freelist = p_block->p_next;
+            p_block->p_next = NULL;
+            pp_blocks[i_msg * i_block_cnt + i_block] = p_block;
+            p_iov[i_block].iov_base = p_block->p_ts;
+        }
     }
-    else
-        i_iov = 0;
 
-    for ( i_block = 0; i_block < i_block_cnt; i_block++ )
+#ifdef HAVE_RECVMMSG
+    if ( p_cmsgs != NULL )
+        /* The kernel overwrites it with the length actually used */
+        for ( i_msg = 0; i_msg < i_batch; i_msg++ )
+            p_msgs[i_msg].msg_hdr.msg_controllen = CMSG_BUFFER_SIZE;
+
+    i_nb_msgs = recvmmsg( p_path->i_handle, p_msgs, i_batch, MSG_WAITFORONE,
+                          NULL );
+#else
+    ssize_t i_read = readv( p_path->i_handle, p_iovs, i_iov_cnt );
+    i_nb_msgs = i_read < 0 ? -1 : 1;
+#endif
+    if ( i_nb_msgs < 0 )
     {
-        *pp_current = block_New();
-        p_iov[i_iov].iov_base = (*pp_current)->p_ts;
-        p_iov[i_iov].iov_len = TS_SIZE;
-        pp_current = &(*pp_current)->p_next;
-        i_iov++;
+        msg_Err( NULL, "couldn't read from network (%s)", strerror(errno) );
+        i_nb_msgs = 0;
     }
-    pp_current = &p_ts;
 
-    if ( (i_len = readv( i_handle, p_iov, i_iov )) < 0 )
+    i_nb_wakeups++;
+    i_nb_datagrams += i_nb_msgs;
+    p_path->i_datagrams += i_nb_msgs;
+    if ( i_nb_msgs == i_batch )
+        i_nb_full_batches++;
+    if ( i_nb_msgs > i_max_datagrams )
+        i_max_datagrams = i_nb_msgs;
+
+    for ( i_msg = 0; i_msg < i_nb_msgs; i_msg++ )
+        p_arrivals[i_msg] = i_wallclock;
+#if defined(HAVE_SO_TIMESTAMPING) && defined(HAVE_RECVMMSG)
+    if ( p_cmsgs != NULL && i_nb_msgs )
     {
-        msg_Err( NULL, "couldn't read from network (%s)", strerror(errno) );
-        goto err;
+        /* Software timestamps use CLOCK_REALTIME, mdate() is monotonic */
+        struct timespec ts;
+        clock_gettime( CLOCK_REALTIME, &ts );
+        mtime_t i_realtime_offset = i_wallclock
+            - ((mtime_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+
+        for ( i_msg = 0; i_msg < i_nb_msgs; i_msg++ )
+            p_arrivals[i_msg] = udp_GetArrival( p_path,
+                                    &p_msgs[i_msg].msg_hdr, i_realtime_offset );
     }
+#endif
 
-    if ( !b_udp )
+    for ( i_msg = 0; i_msg < i_batch; i_msg++ )
     {
-        uint8_t pi_new_ssrc[4];
+        block_t **pp_msg_blocks = &pp_blocks[i_msg * i_block_cnt];
+        block_t *p_raw = NULL, **pp_raw_current = &p_raw;
+        block_t *p_msg_ts = NULL, **pp_msg_current = &p_msg_ts;
+        uint8_t *p_rtp_hdr = &p_rtp_hdrs[i_msg * RTP_HEADER_SIZE];
+        ssize_t i_len = 0;
 
-        if ( !rtp_check_hdr(p_rtp_hdr) )
-            msg_Warn( NULL, "invalid RTP packet received" );
-        if ( rtp_get_type(p_rtp_hdr) != RTP_TYPE_TS )
-            msg_Warn( NULL, "non-TS RTP packet received" );
-        rtp_get_ssrc(p_rtp_hdr, pi_new_ssrc);
-        if ( !memcmp( pi_ssrc, pi_new_ssrc, 4 * sizeof(uint8_t) ) )
+        if ( i_msg < i_nb_msgs )
         {
-            if ( rtp_get_seqnum(p_rtp_hdr) != i_seqnum )
-                msg_Warn( NULL, "RTP discontinuity" );
+#ifdef HAVE_RECVMMSG
+            i_len = p_msgs[i_msg].msg_len;
+#else
+            i_len = i_read;
+#endif
+            if ( !b_udp )
+            {
+                uint16_t i_rtp_seqnum = rtp_get_seqnum( p_rtp_hdr );
+
+                if ( udp_CheckRTP( p_path, p_rtp_hdr ) && p_reorder != NULL )
+                {
+                    /* New source, forget about the previous sequence */
+                    pp_current = udp_ReorderRelease( pp_current, true );
+                    b_reorder_sync = false;
+                }
+
+                if ( p_path->b_seqnum )
+                {
+                    int16_t i_gap = i_rtp_seqnum - p_path->i_next_seqnum;
+                    if ( i_gap > 0 )
+                        p_path->i_lost += i_gap;
+                }
+                p_path->i_next_seqnum = i_rtp_seqnum + 1;
+                p_path->b_seqnum = true;
+
+                i_len -= RTP_HEADER_SIZE;
+            }
+            if ( i_len < 0 )
+                i_len = 0;
         }
-        else
+
+        /* Chain the filled blocks, recycle the others */
+        for ( i_block = 0; i_block < i_block_cnt; i_block++ )
         {
-            struct in_addr addr;
-            memcpy( &addr.s_addr, pi_new_ssrc, 4 * sizeof(uint8_t) );
-            msg_Dbg( NULL, "new RTP source: %s", inet_ntoa( addr ) );
-            memcpy( pi_ssrc, pi_new_ssrc, 4 * sizeof(uint8_t) );
-            switch (i_print_type) {
-            case PRINT_XML:
-                fprintf(print_fh,
-                        "<STATUS type=\"rtpsource\" source=\"%s\"/>\n",
-                        inet_ntoa( addr ));
-                break;
-            case PRINT_TEXT:
-                fprintf(print_fh, "rtpsource: %s\n", inet_ntoa( addr ) );
-                break;
-            default:
-                break;
+            if ( i_block * TS_SIZE < i_len )
+            {
+                pp_msg_blocks[i_block]->i_dts = p_arrivals[i_msg];
+                *pp_raw_current = pp_msg_blocks[i_block];
+                pp_raw_current = &(*pp_raw_current)->p_next;
+            }
+            else
+            {
+                pp_msg_blocks[i_block]->p_next = p_freelist;
+                p_freelist = pp_msg_blocks[i_block];
             }
         }
-        i_seqnum = rtp_get_seqnum(p_rtp_hdr) + 1;
+        *pp_raw_current = NULL;
 
-        i_len -= RTP_HEADER_SIZE;
-    }
+        if ( i_msg >= i_nb_msgs )
+            continue;
 
-    i_len /= TS_SIZE;
+        /* Datagrams normally hold whole packets, don't carry bytes over */
+        pp_msg_current = tssync_Run( p_raw, i_len, false, pp_msg_current );
+        for ( p_raw = p_msg_ts; p_raw != NULL; p_raw = p_raw->p_next )
+            i_nb_blocks++;
 
-    if ( i_len )
+        if ( p_reorder != NULL )
+            pp_current = udp_ReorderPut( p_path, rtp_get_seqnum(p_rtp_hdr),
+                                         p_msg_ts, pp_current );
+        else
+        {
+            *pp_current = p_msg_ts;
+            pp_current = pp_msg_current;
+            p_path->i_forwarded++;
+        }
+    }
+    *pp_current = NULL;
+
+    if ( i_nb_blocks )
     {
         if ( !b_sync )
         {
@@ -421,17 +737,297 @@ static void udp_Read(struct ev_loop *loop, struct ev_io *w, int revents)
         ev_timer_again(loop, &mute_watcher);
     }
 
-    while ( i_len && *pp_current )
+    udp_Demux( p_ts );
+}
+
+/*****************************************************************************
+ * udp_Demux: passes the blocks to the demux, keeping the kernel arrival
+ * dates if they were requested
+ *****************************************************************************/
+static void udp_Demux( block_t *p_ts )
+{
+    if ( b_rx_timestamps )
+        demux_RunDated( p_ts );
+    else
+        demux_Run( p_ts );
+}
+
+#ifdef HAVE_SO_TIMESTAMPING
+/*****************************************************************************
+ * udp_EnableTimestamps: requests kernel receive timestamps on a socket
+ *****************************************************************************/
+static void udp_EnableTimestamps( int i_handle, int i_rx_timestamp,
+                                  const char *psz_ifname )
+{
+    int i_flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+
+    if ( i_rx_timestamp == RX_TIMESTAMP_HARDWARE )
+    {
+        i_flags |= SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+
+        if ( psz_ifname != NULL )
+        {
+            struct hwtstamp_config config;
+            struct ifreq ifr;
+
+            memset( &config, 0, sizeof(config) );
+            config.tx_type = HWTSTAMP_TX_OFF;
+            config.rx_filter = HWTSTAMP_FILTER_ALL;
+            memset( &ifr, 0, sizeof(ifr) );
+            strncpy( ifr.ifr_name, psz_ifname, IFNAMSIZ - 1 );
+            ifr.ifr_data = (void *)&config;
+
+            if ( ioctl( i_handle, SIOCSHWTSTAMP, &ifr ) < 0 )
+                msg_Warn( NULL, "couldn't enable hardware timestamps on %s (%s), using software timestamps",
+                          psz_ifname, strerror(errno) );
+        }
+        else
+            msg_Warn( NULL, "hardware timestamps must be enabled on the interface, or use ifname=" );
+    }
+
+    if ( setsockopt( i_handle, SOL_SOCKET, SO_TIMESTAMPING,
+                     &i_flags, sizeof(i_flags) ) < 0 )
+        msg_Warn( NULL, "couldn't enable kernel timestamps (%s)",
+                  strerror(errno) );
+}
+
+/*****************************************************************************
+ * udp_GetArrival: returns the arrival date of a datagram in the mdate()
+ * time base, from its kernel timestamp if any
+ *****************************************************************************/
+static mtime_t udp_GetArrival( udp_path_t *p_path, struct msghdr *p_mh,
+                               mtime_t i_realtime_offset )
+{
+    struct cmsghdr *p_cmsg;
+
+    for ( p_cmsg = CMSG_FIRSTHDR( p_mh ); p_cmsg != NULL;
+          p_cmsg = CMSG_NXTHDR( p_mh, p_cmsg ) )
+    {
+        const struct timespec *p_ts;
+        mtime_t i_date, i_offset;
+
+        if ( p_cmsg->cmsg_level != SOL_SOCKET
+              || p_cmsg->cmsg_type != SCM_TIMESTAMPING )
+            continue;
+
+        /* ts[0] is the software timestamp, ts[2] the raw hardware one */
+        p_ts = (const struct timespec *)CMSG_DATA( p_cmsg );
+        if ( p_path->i_rx_timestamp == RX_TIMESTAMP_HARDWARE
+              && (p_ts[2].tv_sec || p_ts[2].tv_nsec) )
+        {
+            /* The NIC clock is unrelated to ours: track the offset of the
+             * earliest wakeup, as the datagram can't be read before it
+             * arrives */
+            i_date = (mtime_t)p_ts[2].tv_sec * 1000000
+                      + p_ts[2].tv_nsec / 1000;
+            i_offset = i_wallclock - i_date;
+
+            if ( !p_path->b_hw_offset
+                  || i_offset - p_path->i_hw_offset > HW_OFFSET_MAX_JUMP
+                  || i_offset - p_path->i_hw_offset < -HW_OFFSET_MAX_JUMP )
+            {
+                p_path->i_hw_offset = i_offset;
+                p_path->b_hw_offset = true;
+            }
+            else if ( i_offset < p_path->i_hw_offset )
+                p_path->i_hw_offset = i_offset;
+            else
+                p_path->i_hw_offset += (i_offset - p_path->i_hw_offset)
+                                        / HW_OFFSET_DRIFT_FACTOR;
+            i_date += p_path->i_hw_offset;
+        }
+        else if ( p_ts[0].tv_sec || p_ts[0].tv_nsec )
+            i_date = (mtime_t)p_ts[0].tv_sec * 1000000
+                      + p_ts[0].tv_nsec / 1000 + i_realtime_offset;
+        else
+            break;
+
+        return i_date < i_wallclock ? i_date : i_wallclock;
+    }
+
+    return i_wallclock;
+}
+#endif
+
+/*****************************************************************************
+ * udp_CheckRTP: checks the RTP header of a received datagram, returns true
+ * if the source of the path changed
+ *****************************************************************************/
+static bool udp_CheckRTP( udp_path_t *p_path, const uint8_t *p_rtp_hdr )
+{
+    uint8_t pi_new_ssrc[4];
+    bool b_new_source = false;
+
+    if ( !rtp_check_hdr(p_rtp_hdr) )
+        msg_Warn( NULL, "invalid RTP packet received" );
+    if ( rtp_get_type(p_rtp_hdr) != RTP_TYPE_TS )
+        msg_Warn( NULL, "non-TS RTP packet received" );
+    rtp_get_ssrc(p_rtp_hdr, pi_new_ssrc);
+    if ( p_path->b_ssrc
+          && !memcmp( p_path->pi_ssrc, pi_new_ssrc, 4 * sizeof(uint8_t) ) )
+    {
+        /* When reordering, losses are reported by udp_ReorderRelease */
+        if ( rtp_get_seqnum(p_rtp_hdr) != i_seqnum && p_reorder == NULL )
+            msg_Warn( NULL, "RTP discontinuity" );
+    }
+    else
+    {
+        /* The first source of a path doesn't disturb the merge */
+        b_new_source = p_path->b_ssrc;
+        struct in_addr addr;
+        memcpy( &addr.s_addr, pi_new_ssrc, 4 * sizeof(uint8_t) );
+        msg_Dbg( NULL, "new RTP source: %s", inet_ntoa( addr ) );
+        memcpy( p_path->pi_ssrc, pi_new_ssrc, 4 * sizeof(uint8_t) );
+        p_path->b_ssrc = true;
+        switch (i_print_type) {
+        case PRINT_XML:
+            fprintf(print_fh,
+                    "<STATUS type=\"rtpsource\" source=\"%s\"/>\n",
+                    inet_ntoa( addr ));
+            break;
+        case PRINT_TEXT:
+            fprintf(print_fh, "rtpsource: %s\n", inet_ntoa( addr ) );
+            break;
+        default:
+            break;
+        }
+    }
+    i_seqnum = rtp_get_seqnum(p_rtp_hdr) + 1;
+    return b_new_source;
+}
+
+/*****************************************************************************
+ * udp_ReorderPut: stores a datagram in the reorder buffer and appends the
+ * datagrams which can be released in sequence to pp_current
+ *****************************************************************************/
+static block_t **udp_ReorderPut( udp_path_t *p_path, uint16_t i_rtp_seqnum,
+                                 block_t *p_blocks, block_t **pp_current )
+{
+    reorder_slot_t *p_slot = &p_reorder[i_rtp_seqnum & (REORDER_SLOTS - 1)];
+    int16_t i_diff;
+
+    if ( !b_reorder_sync )
+    {
+        i_reorder_next = i_reorder_last = i_rtp_seqnum;
+        b_reorder_sync = true;
+    }
+
+    i_diff = (int16_t)(i_rtp_seqnum - i_reorder_next);
+    if ( i_diff >= REORDER_SLOTS || i_diff <= -REORDER_SLOTS )
     {
-        pp_current = &(*pp_current)->p_next;
-        i_len--;
+        /* Sequence jump, flush and start over */
+        msg_Warn( NULL, "RTP discontinuity" );
+        pp_current = udp_ReorderRelease( pp_current, true );
+        i_reorder_next = i_reorder_last = i_rtp_seqnum;
+        i_diff = 0;
     }
+    else if ( i_diff < 0 )
+    {
+        if ( p_slot->b_released && p_slot->i_seqnum == i_rtp_seqnum )
+            i_nb_duplicates++;
+        else
+            i_nb_late++;
+        block_DeleteChain( p_blocks );
+        return pp_current;
+    }
+
+    if ( p_slot->b_used )
+    {
+        i_nb_duplicates++;
+        block_DeleteChain( p_blocks );
+        return pp_current;
+    }
+
+    if ( (int16_t)(i_rtp_seqnum - i_reorder_last) < 0 )
+        i_nb_reordered++;
+    else
+        i_reorder_last = i_rtp_seqnum;
+
+    p_slot->p_blocks = p_blocks;
+    p_slot->i_date = i_wallclock;
+    p_slot->i_seqnum = i_rtp_seqnum;
+    p_slot->b_used = true;
+    p_slot->b_released = false;
+    i_reorder_held++;
+    p_path->i_forwarded++;
+
+    return udp_ReorderRelease( pp_current, false );
+}
+
+/*****************************************************************************
+ * udp_ReorderRelease: releases held datagrams in sequence order, skipping
+ * missing ones once the next held datagram has waited for the whole window
+ * (or immediately if b_flush)
+ *****************************************************************************/
+static block_t **udp_ReorderRelease( block_t **pp_current, bool b_flush )
+{
+    while ( i_reorder_held )
+    {
+        reorder_slot_t *p_slot =
+            &p_reorder[i_reorder_next & (REORDER_SLOTS - 1)];
 
-err:
-    block_DeleteChain( *pp_current );
+        if ( !p_slot->b_used )
+        {
+            uint16_t i_held_seqnum = i_reorder_next;
+            reorder_slot_t *p_held;
+            int i_gap = 0;
+
+            do
+            {
+                i_held_seqnum++;
+                i_gap++;
+                p_held = &p_reorder[i_held_seqnum & (REORDER_SLOTS - 1)];
+            }
+            while ( !p_held->b_used );
+
+            if ( !b_flush && p_held->i_date + i_reorder_window > i_wallclock )
+            {
+                ev_timer_stop(event_loop, &reorder_watcher);
+                ev_timer_set(&reorder_watcher,
+                    (p_held->i_date + i_reorder_window - i_wallclock)
+                        / 1000000., 0.);
+                ev_timer_start(event_loop, &reorder_watcher);
+                return pp_current;
+            }
+
+            msg_Warn( NULL, "RTP discontinuity (%d lost)", i_gap );
+            i_nb_lost += i_gap;
+            i_total_lost += i_gap;
+            while ( i_reorder_next != i_held_seqnum )
+            {
+                p_slot = &p_reorder[i_reorder_next & (REORDER_SLOTS - 1)];
+                p_slot->i_seqnum = i_reorder_next;
+                p_slot->b_released = false;
+                i_reorder_next++;
+            }
+            continue;
+        }
+
+        *pp_current = p_slot->p_blocks;
+        while ( *pp_current != NULL )
+            pp_current = &(*pp_current)->p_next;
+
+        p_slot->p_blocks = NULL;
+        p_slot->b_used = false;
+        p_slot->b_released = true;
+        i_reorder_held--;
+        i_reorder_next++;
+    }
+
+    ev_timer_stop(event_loop, &reorder_watcher);
+    return pp_current;
+}
+
+static void udp_ReorderCb(struct ev_loop *loop, struct ev_timer *w, int revents)
+{
+    block_t *p_ts = NULL, **pp_current;
+
+    i_wallclock = mdate();
+    pp_current = udp_ReorderRelease( &p_ts, false );
     *pp_current = NULL;
 
-    demux_Run( p_ts );
+    if ( p_ts != NULL )
+        udp_Demux( p_ts );
 }
 
 static void udp_MuteCb(struct ev_loop *loop, struct ev_timer *w, int revents)
@@ -453,6 +1049,48 @@ static void udp_MuteCb(struct ev_loop *loop, struct ev_timer *w, int revents)
     b_sync = false;
 }
 
+static void udp_PrintCb(struct ev_loop *loop, struct ev_timer *w, int revents)
+{
+    if ( i_batch > 1 )
+    {
+        switch (i_print_type) {
+        case PRINT_XML:
+            fprintf(print_fh, "<STATUS type=\"udp_batch\" wakeups=\"%"PRIu64"\" datagrams=\"%"PRIu64"\" full=\"%"PRIu64"\" max=\"%d\"/>\n",
+                    i_nb_wakeups, i_nb_datagrams, i_nb_full_batches,
+                    i_max_datagrams);
+            break;
+        case PRINT_TEXT:
+            fprintf(print_fh, "udp batch: %"PRIu64" wakeups %"PRIu64" datagrams %"PRIu64" full max %d\n",
+                    i_nb_wakeups, i_nb_datagrams, i_nb_full_batches,
+                    i_max_datagrams);
+            break;
+        default:
+            break;
+        }
+    }
+
+    i_nb_wakeups = i_nb_datagrams = i_nb_full_batches = 0;
+    i_max_datagrams = 0;
+
+    if ( p_reorder == NULL )
+        return;
+
+    switch (i_print_type) {
+    case PRINT_XML:
+        fprintf(print_fh, "<STATUS type=\"rtp_reorder\" reordered=\"%"PRIu64"\" late=\"%"PRIu64"\" duplicates=\"%"PRIu64"\" lost=\"%"PRIu64"\"/>\n",
+                i_nb_reordered, i_nb_late, i_nb_duplicates, i_nb_lost);
+        break;
+    case PRINT_TEXT:
+        fprintf(print_fh, "rtp reorder: %"PRIu64" reordered %"PRIu64" late %"PRIu64" duplicates %"PRIu64" lost\n",
+                i_nb_reordered, i_nb_late, i_nb_duplicates, i_nb_lost);
+        break;
+    default:
+        break;
+    }
+
+    i_nb_reordered = i_nb_late = i_nb_duplicates = i_nb_lost = 0;
+}
+
 /* From now on these are just stubs */
 
 /*****************************************************************************
@@ -477,3 +1115,25 @@ void udp_Reset( void )
 {
 }
 
+/*****************************************************************************
+ * udp_InputStatus
+ *****************************************************************************/
+uint8_t udp_InputStatus( uint8_t *p_answer, ssize_t *pi_size )
+{
+    struct ret_input_status *p_ret = (struct ret_input_status *)p_answer;
+    int i;
+
+    memset( p_ret, 0, sizeof(struct ret_input_status) );
+    p_ret->i_nb_paths = i_nb_paths;
+    p_ret->i_lost = p_reorder != NULL ? i_total_lost : p_paths[0].i_lost;
+    for ( i = 0; i < i_nb_paths; i++ )
+    {
+        p_ret->paths[i].i_datagrams = p_paths[i].i_datagrams;
+        p_ret->paths[i].i_forwarded = p_paths[i].i_forwarded;
+        p_ret->paths[i].i_lost = p_paths[i].i_lost;
+    }
+
+    *pi_size = sizeof(struct ret_input_status);
+    return RET_INPUT_STATUS;
+}
+
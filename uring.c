@@ -0,0 +1,301 @@
+/*****************************************************************************
+ * uring.c: asynchronous output through io_uring
+ *****************************************************************************
+ * Copyright (C) 2026 VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+#include "config.h"
+
+#ifdef HAVE_IO_URING
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <errno.h>
+
+#include <ev.h>
+#include <liburing.h>
+
+#include "dvblast.h"
+
+/*****************************************************************************
+ * Local declarations
+ *****************************************************************************/
+#define URING_ENTRIES 256       /* submission queue */
+#define URING_BUFFERS 4096      /* datagrams in flight */
+#define URING_BUFFER_SIZE 2048  /* larger datagrams are sent with writev */
+#define URING_MAX_FILES 1024    /* output sockets */
+
+static struct io_uring ring;
+static bool b_ring = false, b_ring_failed = false;
+static struct ev_io uring_watcher;
+static int i_eventfd = -1;
+
+/* All buffers are registered as one region, buffer index 0 */
+static uint8_t *p_buffers = NULL;
+static uint16_t pi_free_buffers[URING_BUFFERS];
+static int i_nb_free_buffers = 0;
+
+static int pi_files[URING_MAX_FILES];
+static unsigned int i_nb_queued = 0;
+
+/*****************************************************************************
+ * Local prototypes
+ *****************************************************************************/
+static void uring_Read( struct ev_loop *loop, struct ev_io *w, int revents );
+
+/*****************************************************************************
+ * uring_Init: sets up the ring, the registered buffers and the file table
+ *****************************************************************************/
+static bool uring_Init( void )
+{
+    struct io_uring_params params;
+    struct iovec iov;
+    int i, i_ret;
+
+    memset( &params, 0, sizeof(params) );
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = URING_BUFFERS;
+    if ( (i_ret = io_uring_queue_init_params( URING_ENTRIES, &ring,
+                                              &params )) < 0 )
+    {
+        msg_Warn( NULL, "couldn't create io_uring (%s), using writev",
+                  strerror(-i_ret) );
+        return false;
+    }
+
+    p_buffers = malloc( URING_BUFFERS * URING_BUFFER_SIZE );
+    iov.iov_base = p_buffers;
+    iov.iov_len = URING_BUFFERS * URING_BUFFER_SIZE;
+    for ( i = 0; i < URING_MAX_FILES; i++ )
+        pi_files[i] = -1;
+
+    if ( (i_ret = io_uring_register_buffers( &ring, &iov, 1 )) < 0
+          || (i_ret = io_uring_register_files( &ring, pi_files,
+                                               URING_MAX_FILES )) < 0 )
+    {
+        msg_Warn( NULL, "couldn't register io_uring resources (%s), using writev",
+                  strerror(-i_ret) );
+        goto error;
+    }
+
+    if ( (i_eventfd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC )) < 0
+          || io_uring_register_eventfd( &ring, i_eventfd ) < 0 )
+    {
+        msg_Warn( NULL, "couldn't register io_uring eventfd (%s), using writev",
+                  strerror(errno) );
+        goto error;
+    }
+
+    for ( i = 0; i < URING_BUFFERS; i++ )
+        pi_free_buffers[i] = URING_BUFFERS - 1 - i;
+    i_nb_free_buffers = URING_BUFFERS;
+
+    ev_io_init( &uring_watcher, uring_Read, i_eventfd, EV_READ );
+    ev_io_start( event_loop, &uring_watcher );
+
+    msg_Dbg( NULL, "io_uring output engine ready" );
+    b_ring = true;
+    return true;
+
+error:
+    if ( i_eventfd >= 0 )
+        close( i_eventfd );
+    i_eventfd = -1;
+    io_uring_queue_exit( &ring );
+    free( p_buffers );
+    p_buffers = NULL;
+    return false;
+}
+
+/*****************************************************************************
+ * uring_Reap: releases the buffers of completed sends
+ *****************************************************************************/
+static void uring_Reap( void )
+{
+    struct io_uring_cqe *pp_cqes[URING_ENTRIES];
+    unsigned int i_nb, i;
+
+    while ( (i_nb = io_uring_peek_batch_cqe( &ring, pp_cqes,
+                                             URING_ENTRIES )) > 0 )
+    {
+        for ( i = 0; i < i_nb; i++ )
+        {
+            if ( pp_cqes[i]->res < 0 )
+                msg_Err( NULL, "couldn't send datagram (%s)",
+                         strerror(-pp_cqes[i]->res) );
+            pi_free_buffers[i_nb_free_buffers++] =
+                (uintptr_t)io_uring_cqe_get_data( pp_cqes[i] );
+        }
+        io_uring_cq_advance( &ring, i_nb );
+    }
+}
+
+/*****************************************************************************
+ * uring_Read: eventfd callback, harvests completions
+ *****************************************************************************/
+static void uring_Read( struct ev_loop *loop, struct ev_io *w, int revents )
+{
+    eventfd_t i_count;
+
+    eventfd_read( i_eventfd, &i_count );
+    uring_Reap();
+}
+
+/*****************************************************************************
+ * uring_AddFile: registers an output socket, returns its fixed file index
+ * or -1 if the writev path must be used
+ *****************************************************************************/
+int uring_AddFile( int i_fd )
+{
+    int i;
+
+    if ( !b_ring )
+    {
+        if ( b_ring_failed )
+            return -1;
+        if ( !uring_Init() )
+        {
+            b_ring_failed = true;
+            return -1;
+        }
+    }
+
+    for ( i = 0; i < URING_MAX_FILES; i++ )
+        if ( pi_files[i] == -1 )
+            break;
+    if ( i == URING_MAX_FILES )
+    {
+        msg_Warn( NULL, "too many io_uring outputs, using writev" );
+        return -1;
+    }
+
+    if ( io_uring_register_files_update( &ring, i, &i_fd, 1 ) < 0 )
+        return -1;
+    pi_files[i] = i_fd;
+    return i;
+}
+
+/*****************************************************************************
+ * uring_DelFile: unregisters an output socket; sends in flight keep their
+ * own reference on the file
+ *****************************************************************************/
+void uring_DelFile( int i_index )
+{
+    int i_fd = -1;
+
+    if ( !b_ring || i_index < 0 )
+        return;
+    io_uring_register_files_update( &ring, i_index, &i_fd, 1 );
+    pi_files[i_index] = -1;
+}
+
+/*****************************************************************************
+ * uring_Queue: copies a datagram to a registered buffer and queues its send
+ * on fixed file i_index; returns -1 if it must be sent synchronously
+ *****************************************************************************/
+int uring_Queue( int i_index, const struct iovec *p_iov, int i_iov )
+{
+    struct io_uring_sqe *p_sqe;
+    uint8_t *p_buffer;
+    size_t i_len = 0;
+    uint16_t i_buffer;
+    int i;
+
+    for ( i = 0; i < i_iov; i++ )
+        i_len += p_iov[i].iov_len;
+    if ( i_len > URING_BUFFER_SIZE )
+        return -1;
+
+    if ( !i_nb_free_buffers )
+        uring_Reap();
+    if ( !i_nb_free_buffers )
+        return -1;
+
+    if ( (p_sqe = io_uring_get_sqe( &ring )) == NULL )
+    {
+        uring_Submit();
+        if ( (p_sqe = io_uring_get_sqe( &ring )) == NULL )
+            return -1;
+    }
+
+    i_buffer = pi_free_buffers[--i_nb_free_buffers];
+    p_buffer = p_buffers + (size_t)i_buffer * URING_BUFFER_SIZE;
+    for ( i_len = 0, i = 0; i < i_iov; i++ )
+    {
+        memcpy( p_buffer + i_len, p_iov[i].iov_base, p_iov[i].iov_len );
+        i_len += p_iov[i].iov_len;
+    }
+
+    io_uring_prep_write_fixed( p_sqe, i_index, p_buffer, i_len, 0, 0 );
+    p_sqe->flags |= IOSQE_FIXED_FILE;
+    io_uring_sqe_set_data( p_sqe, (void *)(uintptr_t)i_buffer );
+    i_nb_queued++;
+    return 0;
+}
+
+/*****************************************************************************
+ * uring_Submit: submits the queued sends without waiting, returns the
+ * number of system calls
+ *****************************************************************************/
+int uring_Submit( void )
+{
+    int i_ret;
+
+    if ( !i_nb_queued )
+        return 0;
+    i_nb_queued = 0;
+
+    if ( (i_ret = io_uring_submit( &ring )) < 0 )
+        msg_Err( NULL, "couldn't submit to io_uring (%s)", strerror(-i_ret) );
+    return 1;
+}
+
+/*****************************************************************************
+ * uring_Close: waits for the sends in flight and frees the ring
+ *****************************************************************************/
+void uring_Close( void )
+{
+    if ( !b_ring )
+        return;
+
+    uring_Submit();
+    while ( i_nb_free_buffers < URING_BUFFERS )
+    {
+        struct io_uring_cqe *p_cqe;
+        if ( io_uring_wait_cqe( &ring, &p_cqe ) < 0 )
+            break;
+        uring_Reap();
+    }
+
+    ev_io_stop( event_loop, &uring_watcher );
+    io_uring_queue_exit( &ring );
+    close( i_eventfd );
+    i_eventfd = -1;
+    free( p_buffers );
+    p_buffers = NULL;
+    b_ring = false;
+}
+
+#endif
@@ -43,69 +43,12 @@
 /*****************************************************************************
  * Local declarations
  *****************************************************************************/
-#define MAX_BLOCKS 500
 #define MAX_MSG 1024
 #define VERB_DBG  4
 #define VERB_INFO 3
 #define VERB_WARN 2
 #define VERB_ERR 1
 
-static block_t *p_block_lifo = NULL;
-static unsigned int i_block_count = 0;
-
-/*****************************************************************************
- * block_New
- *****************************************************************************/
-block_t *block_New( void )
-{
-    block_t *p_block;
-
-    if (i_block_count)
-    {
-        p_block = p_block_lifo;
-        p_block_lifo = p_block->p_next;
-        i_block_count--;
-    }
-    else
-    {
-        p_block = malloc(sizeof(block_t));
-    }
-
-    p_block->p_next = NULL;
-    p_block->i_refcount = 1;
-    return p_block;
-}
-
-/*****************************************************************************
- * block_Delete
- *****************************************************************************/
-void block_Delete( block_t *p_block )
-{
-    if (i_block_count >= MAX_BLOCKS )
-    {
-        free( p_block );
-        return;
-    }
-
-    p_block->p_next = p_block_lifo;
-    p_block_lifo = p_block;
-    i_block_count++;
-}
-
-/*****************************************************************************
- * block_Vacuum
- *****************************************************************************/
-void block_Vacuum( void )
-{
-    while (i_block_count)
-    {
-        block_t *p_block = p_block_lifo;
-        p_block_lifo = p_block->p_next;
-        free(p_block);
-        i_block_count--;
-    }
-}
-
 /*****************************************************************************
  * msg_Connect
  *****************************************************************************/
@@ -295,6 +238,8 @@ int dvb_string_cmp(const dvb_string_t *p_1, const dvb_string_t *p_2)
 /*****************************************************************************
  * mdate
  *****************************************************************************/
+static mtime_t i_mdate_offset = 0;
+
 mtime_t mdate( void )
 {
 #if defined (HAVE_CLOCK_NANOSLEEP)
@@ -306,7 +251,8 @@ mtime_t mdate( void )
         (void)clock_gettime( CLOCK_REALTIME, &ts );
 
     return ((mtime_t)ts.tv_sec * (mtime_t)1000000)
-            + (mtime_t)(ts.tv_nsec / 1000);
+            + (mtime_t)(ts.tv_nsec / 1000)
+            + __atomic_load_n( &i_mdate_offset, __ATOMIC_RELAXED );
 #else
     struct timeval tv_date;
 
@@ -314,10 +260,26 @@ mtime_t mdate( void )
      * only possible error, according to 'man', is EFAULT, which can not happen
      * here, since tv is a local variable. */
     gettimeofday( &tv_date, NULL );
-    return( (mtime_t) tv_date.tv_sec * 1000000 + (mtime_t) tv_date.tv_usec );
+    return( (mtime_t) tv_date.tv_sec * 1000000 + (mtime_t) tv_date.tv_usec
+            + __atomic_load_n( &i_mdate_offset, __ATOMIC_RELAXED ) );
 #endif
 }
 
+/*****************************************************************************
+ * mdate_Forward: moves the clock forward to i_date if it is in the future,
+ * for replays faster than real time; returns the time skipped
+ *****************************************************************************/
+mtime_t mdate_Forward( mtime_t i_date )
+{
+    mtime_t i_skip = i_date - mdate();
+
+    if ( i_skip <= 0 )
+        return 0;
+    /* Sender threads read the offset through mdate() */
+    __atomic_fetch_add( &i_mdate_offset, i_skip, __ATOMIC_RELAXED );
+    return i_skip;
+}
+
 /*****************************************************************************
  * msleep
  *****************************************************************************/